@@ -27,6 +27,8 @@
 #include <dirent.h>
 #include "shapefil.h"
 #include "../tmrs_structs.h"
+#include "../simplify.h"
+#include "../coords.h"
 
 
 // Function prototypes
@@ -35,7 +37,8 @@ void process_polylines(SHPHandle hSHP, DBFHandle hDBF, int numRecs);
 void process_polygons(SHPHandle hSHP, DBFHandle hDBF, int numRecs);
 
 // global variables (bad idea, I know)
-FILE *fp_segments, *fp_chains, *fp_polygons;
+FILE *fp_segments, *fp_chains, *fp_polygons, *fp_polygon_boxes;
+FILE *fp_chain_levels[NUM_DETAIL_LEVELS], *fp_polygon_levels[NUM_DETAIL_LEVELS];
 struct _StreetName *street;
 int num_segments, num_chains, num_polygons, num_names;
 int name_index_start, allocated_mem;
@@ -44,7 +47,7 @@ int name_index_start, allocated_mem;
 /* program entry point */
 int main(int argc, char **argv)
 {
-    int optchar, len;
+    int optchar, len, marker = CODED_MARKER;
     char filename[256];
     char *data_dir = "./";   // default directory
     FILE *fp_names;
@@ -79,10 +82,19 @@ int main(int argc, char **argv)
     fp_segments= fopen("segments.dat", "w" );
     fp_chains = fopen("chains.dat", "w");
     fp_polygons = fopen("polygons.dat", "w");
+    fp_polygon_boxes = fopen("polygon_boxes.dat", "w");
 
-    // write the initial count for chains and polygons
+    // write the marker of delta coded points and the initial count for 
+    // chains and polygons
+    fwrite(&marker, sizeof(int), 1, fp_chains);
     fwrite(&num_chains, sizeof(int), 1, fp_chains);
+    fwrite(&marker, sizeof(int), 1, fp_polygons);
     fwrite(&num_polygons, sizeof(int), 1, fp_polygons);
+    fwrite(&num_polygons, sizeof(int), 1, fp_polygon_boxes);
+
+    // simplified chains and polygons for drawing at large scales
+    open_detail_files(fp_chain_levels, "chains");
+    open_detail_files(fp_polygon_levels, "polygons");
 
     // open the data directory 
     dirp = opendir(data_dir);
@@ -121,15 +133,22 @@ int main(int argc, char **argv)
     printf( "------------------------------------------------\n\n");
 
     // update the chain count in the output file before closing
-    fseek(fp_chains, 0, SEEK_SET);
+    fseek(fp_chains, sizeof(int), SEEK_SET);
     fwrite(&num_chains, sizeof(int), 1, fp_chains);
     fclose(fp_chains);
 
     // update the polygon count in the output file before closing
-    fseek(fp_polygons, 0, SEEK_SET);
+    fseek(fp_polygons, sizeof(int), SEEK_SET);
     fwrite(&num_polygons, sizeof(int), 1, fp_polygons);
     fclose(fp_polygons);
 
+    fseek(fp_polygon_boxes, 0, SEEK_SET);
+    fwrite(&num_polygons, sizeof(int), 1, fp_polygon_boxes);
+    fclose(fp_polygon_boxes);
+
+    close_detail_files(fp_chain_levels, num_chains);
+    close_detail_files(fp_polygon_levels, num_polygons);
+
     // write the street names out to file
     fp_names = fopen("names.dat", "w");
     fwrite(street, num_names, sizeof(struct _StreetName), fp_names);
@@ -277,7 +296,8 @@ void process_polygons(SHPHandle hSHP, DBFHandle hDBF, int numRecs)
     int i, j, k, iCFCC, iLandName, start_index, end_index;
     int num_points, percent_complete, prev_percent = -1, p;
     char *cfcc, type, *name;
-    struct _Coordinates c;
+    struct _Coordinates *point;
+    struct _BoundingBox box;
     SHPObject *pShape;
 
     // Verify that this is ESRI Tiger data by looking at attributes in DBF 
@@ -312,6 +332,7 @@ void process_polygons(SHPHandle hSHP, DBFHandle hDBF, int numRecs)
         // read on the shape entry
         pShape = SHPReadObject(hSHP, i);
         name = (char *)DBFReadStringAttribute(hDBF, i, iLandName);
+        point = (struct _Coordinates *)malloc(pShape->nVertices * sizeof(struct _Coordinates));
 
         // each shape record may have multiple parts 
         for (j = 0; j < pShape->nParts; j++)
@@ -328,21 +349,39 @@ void process_polygons(SHPHandle hSHP, DBFHandle hDBF, int numRecs)
 
             // write the number of points which make up this polygon 
             num_points = end_index - start_index + 1;
-            fwrite(&num_points, sizeof(int), 1, fp_polygons);
+            write_coded_int(fp_polygons, num_points);
 
             // write each point out to file 
             for (k = start_index; k <= end_index; k++)
             {
-                c.Latitude = pShape->padfY[k] * 1000000.0;
-                c.Longitude = pShape->padfX[k] * 1000000.0;
-                fwrite(&c, sizeof(c), 1, fp_polygons);
+                point[k-start_index].Latitude = pShape->padfY[k] * 1000000.0;
+                point[k-start_index].Longitude = pShape->padfX[k] * 1000000.0;
+            }
+            write_coded_points(fp_polygons, point, num_points);
+            write_polygon_levels(fp_polygon_levels, type, name, point, num_points);
+
+            // and the rectangle around it, which saves tmrs a pass over 
+            // every point when it starts
+            box.Min = box.Max = point[0];
+            for (k = 1; k < num_points; k++)
+            {
+                if (point[k].Longitude < box.Min.Longitude)
+                    box.Min.Longitude = point[k].Longitude;
+                if (point[k].Longitude > box.Max.Longitude)
+                    box.Max.Longitude = point[k].Longitude;
+                if (point[k].Latitude < box.Min.Latitude)
+                    box.Min.Latitude = point[k].Latitude;
+                if (point[k].Latitude > box.Max.Latitude)
+                    box.Max.Latitude = point[k].Latitude;
             }
+            fwrite(&box, sizeof(struct _BoundingBox), 1, fp_polygon_boxes);
 
             ++num_polygons;
         }
 
 	// free up memory
 	SHPDestroyObject(pShape);
+        free(point);
 
         // progress indicator 
         percent_complete = 100 * i / numRecs;
@@ -402,19 +441,24 @@ int get_name_index(char *name)
 int get_chain_index(SHPObject *pShape)
 {
     int i, num_points;
-    struct _Coordinates c;
+    struct _Coordinates *point;
 
-    num_points = pShape->nVertices - 2;
-    fwrite(&num_points, sizeof(int), 1, fp_chains);
-
-    for (i = 1; i < pShape->nVertices - 1; i++)
+    point = (struct _Coordinates *)malloc(pShape->nVertices * sizeof(struct _Coordinates));
+    for (i = 0; i < pShape->nVertices; i++)
     {
-        c.Latitude = pShape->padfY[i] * 1000000.0;
-        c.Longitude = pShape->padfX[i] * 1000000.0;
-
-        fwrite(&c, sizeof(c), 1, fp_chains);
+        point[i].Latitude = pShape->padfY[i] * 1000000.0;
+        point[i].Longitude = pShape->padfX[i] * 1000000.0;
     }
 
+    num_points = pShape->nVertices - 2;
+    write_coded_int(fp_chains, num_points);
+    write_coded_points(fp_chains, &point[1], num_points);
+
+    // the segment end points anchor the simplified versions
+    write_chain_levels(fp_chain_levels, &point[0], &point[1], num_points, 
+        &point[num_points+1]);
+
+    free(point);
     ++num_chains;
 
     return num_chains -1;
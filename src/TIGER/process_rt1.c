@@ -25,12 +25,14 @@
 #include <stdio.h>
 #include "tiger.h"
 #include "../tmrs_structs.h"
+#include "../simplify.h"
+#include "../coords.h"
 #include "tmrs_extract.h"
 
 
 // Function prototypes
 int get_street_index(char *name); 
-int get_shape_index(int tlid, struct _Chains *, FILE *);
+int get_shape_index(int tlid, struct _RoadSegment *, struct _Chains *, FILE *);
 
 
 /**
@@ -119,7 +121,7 @@ void process_rt1(char *filename, struct _Chains *chains,
         memcpy(str, rec1.TLID, sizeof(rec1.TLID));
         tlid = atoi(str);
 
-        segment.ShapeIndex = get_shape_index(tlid, chains, fp_chains);
+        segment.ShapeIndex = get_shape_index(tlid, &segment, chains, fp_chains);
         segment.StreetIndex = get_street_index(rec1.FEDIRP);
 
         fwrite(&segment, sizeof(segment), 1, fp_segments);
@@ -143,11 +145,13 @@ void process_rt1(char *filename, struct _Chains *chains,
 /**
 * This method returns the index in the Shape Points list for the specified 
 * TLID. Once a chain (of shape points) is found, it is also appended to 
-* chains.dat
+* chains.dat and, simplified between the end points of the segment, to the 
+* detail level files.
 *
 * Returns the shape index, -1 if there is no chain for the TLID.
 */
-int get_shape_index(int tlid, struct _Chains *shapes, FILE *fp_chains)
+int get_shape_index(int tlid, struct _RoadSegment *segment, 
+                    struct _Chains *shapes, FILE *fp_chains)
 {
     int i;
 
@@ -156,9 +160,10 @@ int get_shape_index(int tlid, struct _Chains *shapes, FILE *fp_chains)
     {
         if (shapes[i].tlid == tlid)
         {
-            fwrite(&shapes[i].num_points, sizeof(int), 1, fp_chains);
-            fwrite(shapes[i].points, sizeof(struct _Coordinates), 
-                shapes[i].num_points, fp_chains);
+            write_coded_int(fp_chains, shapes[i].num_points);
+            write_coded_points(fp_chains, shapes[i].points, shapes[i].num_points);
+            write_chain_levels(fp_chain_levels, &segment->StartPoint, 
+                shapes[i].points, shapes[i].num_points, &segment->EndPoint);
             ++num_chains_out;
 
             //printf("%d: %d\n", num_chains_out-1, shapes[i].num_points);
@@ -26,6 +26,8 @@
 #include <unistd.h>
 #include <dirent.h>
 #include "../tmrs_structs.h"
+#include "../simplify.h"
+#include "../coords.h"
 #include "tmrs_extract.h"
 
 
@@ -46,7 +48,11 @@
 *
 * chains.dat - street segments that are not straight lines contains shape 
 *         points. Each record in segments.dat may contain an index to an 
-*         entry in this file if appropriate. 
+*         entry in this file if appropriate.  The points are delta coded 
+*         (see coords.h). 
+*
+* chains1.dat, chains2.dat ... - the same chains simplified for drawing maps
+*         at larger scales (see DETAIL_TOLERANCE in tmrs_structs.h).
 */
 int main(int argc, char **argv)
 {
@@ -54,7 +60,7 @@ int main(int argc, char **argv)
     DIR * dirp;
     struct dirent * dp;
     struct _Chains *chains;
-    int len, num_poly, num_link, i, optchar;
+    int len, num_poly, num_link, i, optchar, marker = CODED_MARKER;
     char rt2_filename[256], rt1_filename[256];
     char *data_dir = ".";
     
@@ -94,8 +100,10 @@ int main(int argc, char **argv)
     fp_segments= fopen( "segments.dat", "w" );
     fp_chains = fopen( "chains.dat", "w");
 
-    // write the initial chain count to file
+    // write the marker of delta coded points and the initial chain count 
+    fwrite(&marker, sizeof(int), 1, fp_chains);
     fwrite(&num_chains_out, sizeof(int), 1, fp_chains);
+    open_detail_files(fp_chain_levels, "chains");
 
     // find all RT1 files in the directory and process them.
     for (dp = readdir(dirp); dp != NULL; dp = readdir(dirp))
@@ -141,9 +149,10 @@ int main(int argc, char **argv)
     free(street);
 
     // update the chain count in the output file before closing
-    fseek(fp_chains, 0, SEEK_SET);
+    fseek(fp_chains, sizeof(int), SEEK_SET);
     fwrite(&num_chains_out, sizeof(int), 1, fp_chains);
     fclose(fp_chains);
+    close_detail_files(fp_chain_levels, num_chains_out);
 
     // delete the temporary shape points file
     unlink("temp.dat");
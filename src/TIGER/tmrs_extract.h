@@ -51,6 +51,7 @@ struct _PolygonChainLink
 
 //Functions implemented in process_rt1.c
 void process_rt1(char *, struct _Chains *, FILE *, FILE *);
+FILE *fp_chain_levels[NUM_DETAIL_LEVELS];   // simplified copies of chains.dat
 struct _StreetName *street;
 int num_segments;
 int num_streets, street_index_start, allocated_mem;
@@ -23,6 +23,7 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include "tmrs.h"
 
 
@@ -88,7 +89,7 @@ float get_g_value(struct _GraphNode *m, struct _GraphNode *n)
     struct _Coordinates *point;
 
     // check whether segment is a straight line or not
-    shapeIndex = segment[n->belongs_to].ShapeIndex;
+    shapeIndex = segment_shape[n->belongs_to];
 
     // handle straight line
     if (shapeIndex < 0)
@@ -97,28 +98,28 @@ float get_g_value(struct _GraphNode *m, struct _GraphNode *n)
     // handle segment with shape points
     else
     {
-        num_points = shape[shapeIndex].num_points;
-        point = shape[shapeIndex].point;
+        num_points = CHAIN_LENGTH(shape, shapeIndex);
+        point = CHAIN_POINTS(shape, shapeIndex);
 
-        d = get_distance(&segment[n->belongs_to].StartPoint, &point[0]);
-        for (i = 0; i < shape[shapeIndex].num_points-1; i++)
+        d = get_distance(&segment_start[n->belongs_to], &point[0]);
+        for (i = 0; i < num_points-1; i++)
         {
             d += get_distance(&point[i], &point[i+1]);   
         }
-        d += get_distance(&point[num_points-1], &segment[n->belongs_to].EndPoint);
+        d += get_distance(&point[num_points-1], &segment_end[n->belongs_to]);
     }
 
     // penalize non-interstate segments because there is a chance that 
     // you may get the red light!
-    if (segment[n->belongs_to].RoadClass > 19)     // used to be m, CHECK
+    if (segment_class[n->belongs_to] > 19)     // used to be m, CHECK
         d += 0.01;
 
     // penalize street change a little bit
-    if (segment[m->belongs_to].StreetIndex != segment[n->belongs_to].StreetIndex)
+    if (segment_street[m->belongs_to] != segment_street[n->belongs_to])
         d += 0.08;
 
     // now divide the distance by an approximate speed based on road class
-    g = d / get_speed_limit(segment[n->belongs_to].RoadClass);
+    g = d / get_speed_limit(segment_class[n->belongs_to]);
 
     return g;
 }
@@ -148,21 +149,34 @@ float get_h_value(struct _Coordinates *a, struct _Coordinates *b)
 * endpoint of the start segment and starts the search from there.  It 
 * repeatedly calls process_adjacent_nodes() until there are no nodes in the 
 * 'open list' remaining.
+*
+* route - set to a malloc'd array of the segments of the path, from source 
+*         to destination.  The caller must free it.
+*
+* Returns the number of segments in the path, 0 if there is none.
 */
-void find_shortest_path(int source, int destination, int highwayOnly)
+int find_shortest_path(int source, int destination, int highwayOnly, int **route)
 {
-    int final,i;
-    struct _GraphNode *node1;
+    int final, i, count = 0;
+    struct _GraphNode *node1, *node;
+
+    *route = NULL;
+    if (source == destination)
+    {
+        *route = (int *)malloc(sizeof(int));
+        (*route)[0] = source;
+        return 1;
+    }
 
     // first seed the 'open list' with the source segment
     node1 = (struct _GraphNode *)malloc(sizeof(struct _GraphNode));
     node1->parent = NULL;
     node1->belongs_to = source;
     node1->SoE = 'a';
-    node1->point = segment[source].StartPoint;
+    node1->point = segment_start[source];
     node1->g_value = 0;
-    node1->h_value = get_h_value(&segment[source].StartPoint, 
-        &segment[destination].StartPoint);
+    node1->h_value = get_h_value(&segment_start[source], 
+        &segment_start[destination]);
     node1->f_value = node1->g_value + node1->h_value;
     open_list_add(node1);
 
@@ -175,27 +189,42 @@ void find_shortest_path(int source, int destination, int highwayOnly)
         //           open_list_head->node->SoE); 
         //   print_segment(open_list_head->node->belongs_to);
         //   printf("\n");
-        final = process_adjacent_nodes(open_list_head->node, destination, highwayOnly);
+        node = open_list_head->node;
+        final = process_adjacent_nodes(node, destination, highwayOnly);
         //   print_closed_list();
         //   print_open_list();
 
-        if (final > 0)
+        if (final >= 0)
         {
-            printf("Reached destination.\n");
+            // walk back from the node that reached the destination
+            for (count = 1, node1 = node; node1 != NULL; node1 = node1->parent)
+                ++count;
+
+            *route = (int *)malloc(count * sizeof(int));
+            (*route)[count-1] = destination;
+            for (i = count-2, node1 = node; node1 != NULL; node1 = node1->parent)
+                (*route)[i--] = node1->belongs_to;
+
+            // the source segment is entered once from each of its ends
+            for (i = 1, final = 1; i < count; i++)
+                if ((*route)[i] != (*route)[final-1])
+                    (*route)[final++] = (*route)[i];
+            count = final;
             break;
         }
     }
 
-    printf("Done\n");
-
     // do a little cleanup otherwise subsequent searches will fail.
     open_list_destroy();
     closed_list_destroy();
+
+    return count;
 }
 
 
 /** 
-* Returns true if one of the adjacent streets is the destination. Otherwise -
+* Expands a node of the open list, stopping early if one of the adjacent 
+* streets is the destination.  Otherwise -
 *
 * a. Find segments that intersect at the given node.
 * b. If the other end of the found segment is already in closed list, ignore.
@@ -203,31 +232,41 @@ void find_shortest_path(int source, int destination, int highwayOnly)
 *    arriving from it.  If so, adjust pointers and values.   
 * d. Add adjacent streets to open list (if not already there)
 * e. Add current street to the closed list.
+*
+* Returns the destination segment if it was reached, -1 otherwise.
 */
 int process_adjacent_nodes(struct _GraphNode *node, int dest, int highwayOnly)
 {
-    int i, found = 0;
+    int i, k, count, *nearby, found;
     char soe;
     float g;
-    char str1[16], str2[5];
     struct _Coordinates other_end;
     struct _GraphNode *new_node, *existing_node;
+    struct _BoundingBox box;
+
+    // only segments whose bounding box holds the node can meet it there
+    box.Min = box.Max = node->point;
+    count = grid_query(&segment_grid, &box, segment_box, &nearby);
 
-    for (i = 0; i < numRecs; i++)
+    for (k = 0; k < count; k++)
     {
-        if (highwayOnly && segment[i].RoadClass > 19)  continue;
-        if (segment[i].RoadClass > 49)  continue;
+        i = nearby[k];
+        found = 0;
 
-        if (same_point(&segment[i].StartPoint, &node->point))
+        // highways are stored last, so a highway-only search skips the rest
+        if (highwayOnly && i < group_start[GROUP_HIGHWAY])  continue;
+        if (segment_class[i] > 49)  continue;
+
+        if (same_point(&segment_start[i], &node->point))
         {
             found = 1;
-            other_end = segment[i].EndPoint;
+            other_end = segment_end[i];
             soe = 'b';
         } 
-        else if (same_point(&segment[i].EndPoint, &node->point))
+        else if (same_point(&segment_end[i], &node->point))
         {
             found = 1;
-            other_end = segment[i].StartPoint;
+            other_end = segment_start[i];
             soe = 'a';
         }
 
@@ -258,27 +297,21 @@ int process_adjacent_nodes(struct _GraphNode *node, int dest, int highwayOnly)
                 new_node->belongs_to = i;
                 new_node->SoE = soe;
                 new_node->g_value = node->g_value + get_g_value(node, new_node);
-                new_node->h_value = get_h_value(&other_end, &segment[dest].StartPoint);
+                new_node->h_value = get_h_value(&other_end, &segment_start[dest]);
                 new_node->f_value = new_node->g_value + new_node->h_value;
                 open_list_add(new_node);
             }
 
             if (i == dest)
             {
-                do
-                {
-                    print_segment(new_node->belongs_to);
-                    printf("\n");
-                    new_node = new_node->parent;
-                }  while (new_node != NULL);
-
+                free(nearby);
                 return i;  // reached destination, no point in searching further
             }
-
-            found = 0;
         }
     }
 
+    free(nearby);
+
     // add the current street to the closed list
     open_list_remove(node);
     closed_list_add(node);
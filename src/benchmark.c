@@ -0,0 +1,162 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+/*
+* Compares the size and speed of the tile output formats (-B option).  A 
+* sample of tiles covering the dataset is rendered once, then encoded with 
+* each format and zlib setting in turn.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "gd.h"
+#include "tmrs.h"
+
+
+#define BENCHMARK_TILES     256     // tiles kept in memory for encoding
+
+// formats and -z settings compared, NULL being the zlib default.  Formats 
+// without an encoder (WEBP when gd lacks it) are skipped.
+static char *benchmark_config[][2] = 
+{
+    { "RAW",    NULL },
+    { "RAW565", NULL },
+    { "PPM",    NULL },
+    { "BMP",    NULL },
+    { "PNG",    NULL },
+    { "PNG",    "9" },
+    { "PNG",    "6,rle" },
+    { "PNG8",   "1" },
+    { "PNG8",   NULL },
+    { "PNG8",   "9" },
+    { "PNG8",   "6,filtered" },
+    { "PNG8",   "6,huffman" },
+    { "PNG8",   "6,rle" },
+    { "PNG8",   "9,fixed" },
+    { "WEBP",   NULL },
+};
+
+#define NUM_CONFIGS (sizeof(benchmark_config) / sizeof(benchmark_config[0]))
+
+
+/* returns 1 if every pixel of the image has the same color */
+static int is_blank(gdImagePtr im)
+{
+    int x, y;
+
+    for (y = 0; y < im->sy; y++)
+        for (x = 0; x < im->sx; x++)
+            if (im->tpixels[y][x] != im->tpixels[0][0])
+                return 0;
+
+    return 1;
+}
+
+
+/**
+* Encodes a sample of the tiles of a zoom level in every format and prints 
+* the average size and time per tile.  Blank tiles are left out since they 
+* say little about the encoders.
+*
+* Returns 0 on success.
+*/
+int benchmark_encoders(int zoom)
+{
+    gdImagePtr tile[BENCHMARK_TILES];
+    struct _Buffer buffer;
+    struct timeval start, end;
+    gdSink bufferSink;
+    int num_tiles, c, i, x, y, x1, y1, x2, y2, mx, my, span;
+    long bytes;
+    double ms;
+
+    if (zoom < 0 || zoom > MAX_ZOOM)
+    {
+        printf("Zoom levels must be between 0 and %d.\n", MAX_ZOOM);
+        return 1;
+    }
+
+    // pick tiles metatile by metatile so that each is drawn only once
+    num_tiles = 0;
+    span = get_metatile_span(zoom);
+    get_tile_range(zoom, &x1, &y1, &x2, &y2);
+    for (my = y1 - y1 % span; my <= y2 && num_tiles < BENCHMARK_TILES; my += span)
+        for (mx = x1 - x1 % span; mx <= x2 && num_tiles < BENCHMARK_TILES; mx += span)
+            for (y = my; y < my + span && y <= y2 && num_tiles < BENCHMARK_TILES; y++)
+                for (x = mx; x < mx + span && x <= x2 && num_tiles < BENCHMARK_TILES; x++)
+                {
+                    if (x < x1) continue;
+
+                    tile[num_tiles] = get_tile_image(zoom, x, y);
+                    if (is_blank(tile[num_tiles]))
+                        gdImageDestroy(tile[num_tiles]);
+                    else
+                        ++num_tiles;
+                }
+
+    if (num_tiles == 0)
+    {
+        printf("No tiles with any data at zoom %d.\n", zoom);
+        return 1;
+    }
+
+    printf("Encoding %d tiles of zoom %d\n\n", num_tiles, zoom);
+    printf("format  zlib          bytes/tile   ms/tile\n");
+
+    memset(&buffer, 0, sizeof(struct _Buffer));
+    bufferSink.context = &buffer;
+    bufferSink.sink = buffer_sink;
+
+    for (c = 0; c < NUM_CONFIGS; c++)
+    {
+        if (get_encoder(benchmark_config[c][0]) < 0)
+            continue;
+
+        set_png_compression(benchmark_config[c][1]);
+
+        bytes = 0;
+        gettimeofday(&start, NULL);
+        for (i = 0; i < num_tiles; i++)
+        {
+            buffer.size = 0;
+            image_to_sink(tile[i], benchmark_config[c][0], &bufferSink);
+            bytes += buffer.size;
+        }
+        gettimeofday(&end, NULL);
+
+        ms = (end.tv_sec - start.tv_sec) * 1000.0 + 
+             (end.tv_usec - start.tv_usec) / 1000.0;
+        printf("%-6s  %-12s  %10ld  %8.3f\n", benchmark_config[c][0], 
+            strncmp(benchmark_config[c][0], "PNG", 3) ? "-" : 
+            benchmark_config[c][1] ? benchmark_config[c][1] : "default", 
+            bytes / num_tiles, ms / num_tiles);
+    }
+
+    free(buffer.data);
+    for (i = 0; i < num_tiles; i++)
+        gdImageDestroy(tile[i]);
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+
+#include <stdio.h>
+#include "tmrs_structs.h"
+#include "coords.h"
+
+
+/**
+* Writes a number zigzag and varint coded (see coords.h).
+*/
+void write_coded_int(FILE *fp, int value)
+{
+    unsigned char buffer[5];
+    unsigned int u;
+    int n;
+
+    u = ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+    for (n = 0; u >= 0x80; n++)
+    {
+        buffer[n] = (u & 0x7F) | 0x80;
+        u >>= 7;
+    }
+    buffer[n++] = u;
+
+    fwrite(buffer, 1, n, fp);
+}
+
+
+/**
+* Writes a list of points, each as the difference to the one before it.
+*/
+void write_coded_points(FILE *fp, struct _Coordinates *point, int num_points)
+{
+    struct _Coordinates last = { 0, 0 };
+    int i;
+
+    for (i = 0; i < num_points; i++)
+    {
+        write_coded_int(fp, point[i].Longitude - last.Longitude);
+        write_coded_int(fp, point[i].Latitude - last.Latitude);
+        last = point[i];
+    }
+}
+
+
+/**
+* Reads a number written by write_coded_int() from p.  
+*
+* Returns where the next number starts, NULL if the number runs past end.
+*/
+unsigned char *read_coded_int(unsigned char *p, unsigned char *end, int *value)
+{
+    unsigned int u, shift;
+
+    u = 0;
+    for (shift = 0; p < end && shift < 35; shift += 7)
+    {
+        u |= (unsigned int)(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80))
+        {
+            *value = (int)(u >> 1) ^ -(int)(u & 1);
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+* Reads num_points points written by write_coded_points() from p.
+*
+* Returns where the data after them starts, NULL if they run past end.
+*/
+unsigned char *read_coded_points(unsigned char *p, unsigned char *end, 
+                                 struct _Coordinates *point, int num_points)
+{
+    struct _Coordinates last = { 0, 0 };
+    int i, dx, dy;
+
+    for (i = 0; i < num_points; i++)
+    {
+        p = read_coded_int(p, end, &dx);
+        if (p != NULL)
+            p = read_coded_int(p, end, &dy);
+        if (p == NULL)
+            return NULL;
+
+        last.Longitude += dx;
+        last.Latitude += dy;
+        point[i] = last;
+    }
+
+    return p;
+}
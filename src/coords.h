@@ -0,0 +1,44 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+
+#ifndef _COORDS_H
+#define _COORDS_H
+
+// Chains and polygons files store their points delta coded: each point as 
+// the difference to the point before it (the first point of a chain or 
+// polygon as is), both numbers zigzag coded so that small negative numbers 
+// are small as well, then written 7 bits per byte with the high bit set on 
+// all bytes but the last.  Most points take 2 to 4 bytes instead of 8.  
+// Such files start with CODED_MARKER, then the count; older files with raw 
+// points start with the count.
+#define CODED_MARKER    -1
+
+// functions implemented in coords.c
+void write_coded_int(FILE *fp, int value);
+void write_coded_points(FILE *fp, struct _Coordinates *point, int num_points);
+unsigned char *read_coded_int(unsigned char *p, unsigned char *end, int *value);
+unsigned char *read_coded_points(unsigned char *p, unsigned char *end, 
+                                 struct _Coordinates *point, int num_points);
+
+#endif
@@ -0,0 +1,190 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+/*
+* CRC-32C (Castagnoli) checksums, used to verify packs when they are loaded.  
+* x86 processors with SSE 4.2 and ARM processors with the CRC extension have 
+* an instruction for it that handles 8 bytes at a time; elsewhere a table 
+* driven version that also takes 8 bytes per step is used.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#include "tmrs.h"
+
+#define CRC32C_POLYNOMIAL   0x82F63B78  // reversed
+
+
+static unsigned int crc_table[8][256];
+static int crc_table_ready = 0;
+
+
+/* 
+* fills in the tables of crc32c_table(): entry [k][b] is the checksum of 
+* byte b followed by k zero bytes
+*/
+static void init_crc_table()
+{
+    unsigned int crc;
+    int b, k;
+
+    for (b = 0; b < 256; b++)
+    {
+        crc = b;
+        for (k = 0; k < 8; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        crc_table[0][b] = crc;
+    }
+
+    for (b = 0; b < 256; b++)
+        for (k = 1; k < 8; k++)
+            crc_table[k][b] = (crc_table[k-1][b] >> 8) ^ 
+                crc_table[0][crc_table[k-1][b] & 0xff];
+
+    crc_table_ready = 1;
+}
+
+
+/* the checksum without hardware support, slicing by 8 */
+static unsigned int crc32c_table(unsigned int crc, const unsigned char *p, size_t size)
+{
+    unsigned int low, high;
+
+    if (!crc_table_ready)
+        init_crc_table();
+
+    for (; size > 0 && ((size_t)p & 3); size--)
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        // the bytes are taken one at a time, so this works for any byte order
+        low = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24);
+        high = p[4] | p[5] << 8 | p[6] << 16 | (unsigned int)p[7] << 24;
+        crc = crc_table[7][low & 0xff] ^ crc_table[6][(low >> 8) & 0xff] ^
+              crc_table[5][(low >> 16) & 0xff] ^ crc_table[4][low >> 24] ^
+              crc_table[3][high & 0xff] ^ crc_table[2][(high >> 8) & 0xff] ^
+              crc_table[1][(high >> 16) & 0xff] ^ crc_table[0][high >> 24];
+    }
+
+    for (; size > 0; size--)
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+
+    return crc;
+}
+
+
+#if defined(__x86_64__)
+
+/* the checksum with the SSE 4.2 crc32 instruction */
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_hardware(unsigned int crc, const unsigned char *p, size_t size)
+{
+    unsigned long long crc64, word;
+
+    for (; size > 0 && ((size_t)p & 7); size--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    crc64 = crc;
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (unsigned int)crc64;
+
+    for (; size > 0; size--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return crc;
+}
+
+static int have_hardware_crc()
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+
+/* the checksum with the ARMv8 crc32c instructions */
+static unsigned int crc32c_hardware(unsigned int crc, const unsigned char *p, size_t size)
+{
+    unsigned long long word;
+
+    for (; size > 0 && ((size_t)p & 7); size--)
+        crc = __crc32cb(crc, *p++);
+
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+    }
+
+    for (; size > 0; size--)
+        crc = __crc32cb(crc, *p++);
+
+    return crc;
+}
+
+static int have_hardware_crc()
+{
+    return 1;
+}
+
+#else
+
+#define crc32c_hardware crc32c_table
+
+static int have_hardware_crc()
+{
+    return 0;
+}
+
+#endif
+
+
+/**
+* Returns the CRC-32C of size bytes at data, continuing from the checksum of 
+* the bytes before them in crc (0 to start with).
+*/
+unsigned int crc32c(unsigned int crc, const void *data, size_t size)
+{
+    static int hardware = -1;
+
+    if (hardware < 0)
+        hardware = have_hardware_crc();
+
+    crc = ~crc;
+    if (hardware)
+        crc = crc32c_hardware(crc, (const unsigned char *)data, size);
+    else
+        crc = crc32c_table(crc, (const unsigned char *)data, size);
+
+    return ~crc;
+}
@@ -0,0 +1,281 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+/*
+* Output formats of maps and tiles.  Each format named by the first field of 
+* an 'M' or 'T' request has an entry in the encoder table below; adding a 
+* format is a matter of writing its function and listing it there.
+*
+* Besides PNG and PNG8 (see png.c) there are formats meant for local clients 
+* that would rather not pay for compression: RAW (gd's pixels as they are), 
+* RAW565 (16 bit), PPM and BMP (24 bit).  These are built as one block, or 
+* sent straight from gd's rows, so that they leave in as few writes as 
+* possible.  WEBP (lossless) is available when gd 
+* was built with WebP support.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "gd.h"
+#include "tmrs.h"
+
+
+// an output format
+struct _Encoder
+{
+    char *name;                                      // as given in requests
+    void (*to_sink)(gdImagePtr im, gdSinkPtr pSink);
+};
+
+
+/**
+* This function outputs the image in a raw format to the specified sink. The 
+* sink is generally stdio or a socket.  The size of the output is 
+*
+*    total_bytes = width * height * 4 bytes
+*
+* i.e. 4 bytes / pixel, gd's own 0xAARRGGBB in host byte order (alpha 0 is 
+* opaque).  The rows are sent from where gd keeps them, in a single writev() 
+* when the sink is a socket.
+*/
+static void image_raw_to_sink(gdImagePtr im, gdSinkPtr pSink)
+{
+    struct iovec *iov;
+    int i;
+
+    iov = (struct iovec *)malloc(im->sy * sizeof(struct iovec));
+    for (i = 0; i < im->sy; i++)
+    {
+        iov[i].iov_base = im->tpixels[i];
+        iov[i].iov_len = im->sx * sizeof(int);
+    }
+
+    sink_writev(pSink, iov, im->sy);
+    free(iov);
+}
+
+
+/* 
+* RAW565: 2 bytes / pixel, rrrrrggggggbbbbb as a little endian 16 bit value, 
+* for displays that take it as is.  Half the bytes of RAW.
+*/
+static void image_raw565_to_sink(gdImagePtr im, gdSinkPtr pSink)
+{
+    unsigned char *data, *p;
+    int x, y, c, v, width, *row;
+
+    width = im->sx;
+    data = (unsigned char *)malloc(width * im->sy * 2);
+    p = data;
+    for (y = 0; y < im->sy; y++)
+        for (row = im->tpixels[y], x = 0; x < width; x++)
+        {
+            c = row[x];
+            v = ((c >> 8) & 0xf800) | ((c >> 5) & 0x07e0) | ((c >> 3) & 0x001f);
+            *p++ = v & 0xff;
+            *p++ = v >> 8;
+        }
+
+    sink_write(pSink, (char *)data, im->sx * im->sy * 2);
+    free(data);
+}
+
+
+/* 
+* PNG through gd, with the zlib level given by -z if any.  gd cannot be 
+* given a zlib strategy, so with one the image is written by png.c instead.
+*/
+static void image_png_to_sink(gdImagePtr im, gdSinkPtr pSink)
+{
+    char *data;
+    int size;
+
+    if (get_png_strategy() >= 0 && im->trueColor)
+        image_png24_to_sink(im, pSink);
+    else if (get_png_level() < 0)
+        gdImagePngToSink(im, pSink);
+    else
+    {
+        data = (char *)gdImagePngPtrEx(im, &size, get_png_level());
+        sink_write(pSink, data, size);
+        gdFree(data);
+    }
+}
+
+
+/* binary PPM (P6): a short text header followed by RGB triplets, top down */
+static void image_ppm_to_sink(gdImagePtr im, gdSinkPtr pSink)
+{
+    unsigned char *data, *p;
+    int x, y, c, len, width, *row;
+
+    width = im->sx;
+    data = (unsigned char *)malloc(32 + width * im->sy * 3);
+    len = sprintf((char *)data, "P6\n%d %d\n255\n", width, im->sy);
+
+    p = data + len;
+    for (y = 0; y < im->sy; y++)
+        for (row = im->tpixels[y], x = 0; x < width; x++)
+        {
+            c = row[x];
+            *p++ = gdTrueColorGetRed(c);
+            *p++ = gdTrueColorGetGreen(c);
+            *p++ = gdTrueColorGetBlue(c);
+        }
+
+    sink_write(pSink, (char *)data, p - data);
+    free(data);
+}
+
+
+/* stores a little endian integer of n bytes */
+static void put_le(unsigned char *p, unsigned int value, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        p[i] = (value >> (8 * i)) & 0xff;
+}
+
+
+/* 
+* uncompressed 24 bit BMP: a 54 byte header followed by BGR rows, bottom up, 
+* each padded to a multiple of 4 bytes
+*/
+static void image_bmp_to_sink(gdImagePtr im, gdSinkPtr pSink)
+{
+    unsigned char *data, *header, *p;
+    int x, y, c, stride, size, width, *row;
+
+    stride = (im->sx * 3 + 3) & ~3;
+    size = 54 + stride * im->sy;
+    data = (unsigned char *)calloc(size, 1);
+
+    header = data;
+    header[0] = 'B';
+    header[1] = 'M';
+    put_le(&header[2], size, 4);                    // file size
+    put_le(&header[10], 54, 4);                     // offset of the pixels
+    put_le(&header[14], 40, 4);                     // BITMAPINFOHEADER
+    put_le(&header[18], im->sx, 4);
+    put_le(&header[22], im->sy, 4);
+    put_le(&header[26], 1, 2);                      // planes
+    put_le(&header[28], 24, 2);                     // bits per pixel
+    put_le(&header[34], stride * im->sy, 4);
+    put_le(&header[38], 2835, 4);                   // 72 dpi
+    put_le(&header[42], 2835, 4);
+
+    width = im->sx;
+    for (y = 0; y < im->sy; y++)
+    {
+        p = data + 54 + (im->sy - 1 - y) * stride;
+        for (row = im->tpixels[y], x = 0; x < width; x++)
+        {
+            c = row[x];
+            *p++ = gdTrueColorGetBlue(c);
+            *p++ = gdTrueColorGetGreen(c);
+            *p++ = gdTrueColorGetRed(c);
+        }
+    }
+
+    sink_write(pSink, (char *)data, size);
+    free(data);
+}
+
+
+#ifdef gdWebpLossless
+/* lossless WebP through gd, nothing is sent if gd lacks WebP support */
+static void image_webp_to_sink(gdImagePtr im, gdSinkPtr pSink)
+{
+    char *data;
+    int size;
+
+    data = (char *)gdImageWebpPtrEx(im, &size, gdWebpLossless);
+    if (data == NULL)
+        return;
+
+    sink_write(pSink, data, size);
+    gdFree(data);
+}
+#endif
+
+
+static struct _Encoder encoder[] = 
+{
+    { "RAW",    image_raw_to_sink },
+    { "RAW565", image_raw565_to_sink },
+    { "PNG",    image_png_to_sink },
+    { "PNG8",   image_png8_to_sink },
+    { "PPM",    image_ppm_to_sink },
+    { "BMP",    image_bmp_to_sink },
+#ifdef gdWebpLossless
+    { "WEBP",   image_webp_to_sink },
+#endif
+};
+
+#define NUM_ENCODERS (sizeof(encoder) / sizeof(encoder[0]))
+
+
+/**
+* Returns the index of the encoder of a format, in any case, -1 if there is 
+* none.
+*/
+int get_encoder(char *format)
+{
+    int i;
+
+    for (i = 0; i < NUM_ENCODERS; i++)
+        if (strcasecmp(format, encoder[i].name) == 0)
+            return i;
+
+    return -1;
+}
+
+
+/**
+* Returns the name of the n-th encoder, NULL past the last one.
+*/
+char *get_encoder_name(int n)
+{
+    if (n < 0 || n >= NUM_ENCODERS)
+        return NULL;
+
+    return encoder[n].name;
+}
+
+
+/**
+* Sends the image to the sink in the requested format.  Unknown formats are 
+* sent as RAW.
+*/
+void image_to_sink(gdImagePtr im, char *format, gdSinkPtr pSink)
+{
+    int i;
+
+    i = get_encoder(format);
+    if (i < 0)
+        i = 0;
+
+    encoder[i].to_sink(im, pSink);
+}
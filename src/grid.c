@@ -0,0 +1,341 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+
+#include <stdlib.h>
+#include <math.h>
+#include "tmrs.h"
+
+
+// average number of items we aim to have in one grid cell
+#define GRID_ITEMS_PER_CELL     16
+#define GRID_MAX_DIMENSION      1024
+
+
+/**
+* Grows the given bounding box so that it includes the specified point.
+*/
+void extend_box(struct _BoundingBox *box, struct _Coordinates *p)
+{
+    if (p->Longitude < box->Min.Longitude) box->Min.Longitude = p->Longitude;
+    if (p->Longitude > box->Max.Longitude) box->Max.Longitude = p->Longitude;
+    if (p->Latitude < box->Min.Latitude) box->Min.Latitude = p->Latitude;
+    if (p->Latitude > box->Max.Latitude) box->Max.Latitude = p->Latitude;
+}
+
+
+/**
+* Returns true if the point lies within the bounding box.
+*/
+int box_contains(struct _BoundingBox *box, struct _Coordinates *p)
+{
+    return (p->Longitude >= box->Min.Longitude && 
+            p->Longitude <= box->Max.Longitude &&
+            p->Latitude >= box->Min.Latitude && 
+            p->Latitude <= box->Max.Latitude);
+}
+
+
+/**
+* Returns true if the two bounding boxes overlap.
+*/
+int boxes_intersect(struct _BoundingBox *a, struct _BoundingBox *b)
+{
+    return (a->Min.Longitude <= b->Max.Longitude && 
+            a->Max.Longitude >= b->Min.Longitude &&
+            a->Min.Latitude <= b->Max.Latitude && 
+            a->Max.Latitude >= b->Min.Latitude);
+}
+
+
+/**
+* Computes the bounding box of a road segment including all of its shape 
+* points.
+*/
+static void get_segment_box(int i, struct _BoundingBox *box)
+{
+    int j, shapeIndex;
+    struct _Coordinates *point;
+
+    box->Min = box->Max = segment_start[i];
+    extend_box(box, &segment_end[i]);
+
+    shapeIndex = segment_shape[i];
+    if (shapeIndex < 0) return;
+
+    point = CHAIN_POINTS(shape, shapeIndex);
+    for (j = 0; j < CHAIN_LENGTH(shape, shapeIndex); j++)
+        extend_box(box, &point[j]);
+}
+
+
+/**
+* Converts a coordinate into a grid column or row, clamped to the grid.
+*/
+static int grid_column(struct _Grid *g, int longitude)
+{
+    int col;
+
+    if (longitude <= g->bounds.Min.Longitude) return 0;
+    col = (longitude - g->bounds.Min.Longitude) / g->cell_width;
+
+    return (col < g->cols) ? col : g->cols-1;
+}
+
+static int grid_row(struct _Grid *g, int latitude)
+{
+    int row;
+
+    if (latitude <= g->bounds.Min.Latitude) return 0;
+    row = (latitude - g->bounds.Min.Latitude) / g->cell_height;
+
+    return (row < g->rows) ? row : g->rows-1;
+}
+
+
+/**
+* Builds a uniform grid over the given area.  Every item is registered in 
+* each cell its bounding box touches.  The items in a cell end up sorted by
+* index since they are added in order.
+*
+* g      - the grid to build
+* box    - array of item bounding boxes
+* count  - number of items
+* bounds - the area the grid should cover
+*/
+void grid_build(struct _Grid *g, struct _BoundingBox *box, int count, 
+                struct _BoundingBox *bounds)
+{
+    int i, x, y, x1, x2, y1, y2, cell, num_cells;
+    double width, height, cells;
+    int *fill;
+
+    g->bounds = *bounds;
+
+    // pick the dimensions so that cells are roughly square
+    width = (double)bounds->Max.Longitude - bounds->Min.Longitude + 1;
+    height = (double)bounds->Max.Latitude - bounds->Min.Latitude + 1;
+    cells = (double)count / GRID_ITEMS_PER_CELL;
+
+    g->cols = (int)sqrt(cells * width / height);
+    g->rows = (int)sqrt(cells * height / width);
+    if (g->cols < 1) g->cols = 1;
+    if (g->rows < 1) g->rows = 1;
+    if (g->cols > GRID_MAX_DIMENSION) g->cols = GRID_MAX_DIMENSION;
+    if (g->rows > GRID_MAX_DIMENSION) g->rows = GRID_MAX_DIMENSION;
+
+    g->cell_width = (int)(width / g->cols) + 1;
+    g->cell_height = (int)(height / g->rows) + 1;
+
+    num_cells = g->cols * g->rows;
+    g->cell_start = (int *)calloc(num_cells + 1, sizeof(int));
+    fill = (int *)calloc(num_cells, sizeof(int));
+
+    // first pass counts the entries of each cell
+    for (i = 0; i < count; i++)
+    {
+        x1 = grid_column(g, box[i].Min.Longitude);
+        x2 = grid_column(g, box[i].Max.Longitude);
+        y1 = grid_row(g, box[i].Min.Latitude);
+        y2 = grid_row(g, box[i].Max.Latitude);
+
+        for (y = y1; y <= y2; y++)
+            for (x = x1; x <= x2; x++)
+                ++g->cell_start[y*g->cols + x + 1];
+    }
+
+    for (cell = 0; cell < num_cells; cell++)
+        g->cell_start[cell+1] += g->cell_start[cell];
+
+    // second pass fills in the item indices
+    g->item = (int *)malloc(g->cell_start[num_cells] * sizeof(int));
+    for (i = 0; i < count; i++)
+    {
+        x1 = grid_column(g, box[i].Min.Longitude);
+        x2 = grid_column(g, box[i].Max.Longitude);
+        y1 = grid_row(g, box[i].Min.Latitude);
+        y2 = grid_row(g, box[i].Max.Latitude);
+
+        for (y = y1; y <= y2; y++)
+        {
+            for (x = x1; x <= x2; x++)
+            {
+                cell = y*g->cols + x;
+                g->item[g->cell_start[cell] + fill[cell]++] = i;
+            }
+        }
+    }
+
+    free(fill);
+}
+
+
+static int compare_int(const void *a, const void *b)
+{
+    return *(int *)a - *(int *)b;
+}
+
+
+/**
+* Finds all items whose bounding box intersects the requested area.  An item 
+* that spans several cells is reported only from the first cell (lowest row 
+* and column) it shares with the query so no duplicates are returned.
+*
+* g        - the grid to search
+* area     - the area of interest
+* item_box - the bounding boxes the grid was built from
+* result   - set to a malloc'd array of item indices in ascending order. The
+*            caller must free it.
+*
+* Returns the number of items found.
+*/
+int grid_query(struct _Grid *g, struct _BoundingBox *area, 
+               struct _BoundingBox *item_box, int **result)
+{
+    int x, y, x1, x2, y1, y2, k, i, count, max_count;
+    struct _BoundingBox *b;
+
+    *result = NULL;
+    if (g->item == NULL || !boxes_intersect(area, &g->bounds))
+        return 0;
+
+    x1 = grid_column(g, area->Min.Longitude);
+    x2 = grid_column(g, area->Max.Longitude);
+    y1 = grid_row(g, area->Min.Latitude);
+    y2 = grid_row(g, area->Max.Latitude);
+
+    // the number of entries in the cells is an upper bound on the result
+    max_count = 0;
+    for (y = y1; y <= y2; y++)
+        max_count += g->cell_start[y*g->cols + x2 + 1] - g->cell_start[y*g->cols + x1];
+
+    *result = (int *)malloc((max_count + 1) * sizeof(int));
+
+    count = 0;
+    for (y = y1; y <= y2; y++)
+    {
+        for (x = x1; x <= x2; x++)
+        {
+            for (k = g->cell_start[y*g->cols + x]; k < g->cell_start[y*g->cols + x + 1]; k++)
+            {
+                i = g->item[k];
+                b = &item_box[i];
+
+                if (!boxes_intersect(area, b))  continue;
+
+                // skip if this item was already reported from another cell
+                if ((x != x1 && grid_column(g, b->Min.Longitude) < x) ||
+                    (y != y1 && grid_row(g, b->Min.Latitude) < y))
+                    continue;
+
+                (*result)[count++] = i;
+            }
+        }
+    }
+
+    // callers depend on items being visited in the order they are stored
+    if (x1 != x2 || y1 != y2)
+        qsort(*result, count, sizeof(int), compare_int);
+
+    return count;
+}
+
+
+/**
+* Frees the memory held by a grid.
+*/
+void grid_destroy(struct _Grid *g)
+{
+    free(g->cell_start);
+    free(g->item);
+    g->cell_start = NULL;
+    g->item = NULL;
+}
+
+
+/**
+* Computes bounding boxes for all segments and polygons and builds a grid for 
+* each so that only the data near a given point needs to be looked at. Must 
+* be called after the data files have been loaded.  Boxes already loaded 
+* (from polygon_boxes.dat or a pack) are used as they are.
+*/
+void build_spatial_index()
+{
+    int i, j;
+
+    if (segment_box == NULL)
+    {
+        segment_box = (struct _BoundingBox *)malloc(numRecs * sizeof(struct _BoundingBox));
+        for (i = 0; i < numRecs; i++)
+            get_segment_box(i, &segment_box[i]);
+    }
+
+    if (polygon_box == NULL)
+    {
+        polygon_box = (struct _BoundingBox *)malloc(numPolygons * sizeof(struct _BoundingBox));
+        for (i = 0; i < numPolygons; i++)
+        {
+            polygon_box[i].Min = polygon_box[i].Max = polygon[i].point[0];
+            for (j = 1; j < polygon[i].num_points; j++)
+                extend_box(&polygon_box[i], &polygon[i].point[j]);
+        }
+    }
+
+    // the grids cover everything, including polygons reaching past the roads
+    if (numRecs > 0)
+        dataset_bounds = segment_box[0];
+    else if (numPolygons > 0)
+        dataset_bounds = polygon_box[0];
+
+    for (i = 0; i < numRecs; i++)
+    {
+        extend_box(&dataset_bounds, &segment_box[i].Min);
+        extend_box(&dataset_bounds, &segment_box[i].Max);
+    }
+
+    for (i = 0; i < numPolygons; i++)
+    {
+        extend_box(&dataset_bounds, &polygon_box[i].Min);
+        extend_box(&dataset_bounds, &polygon_box[i].Max);
+    }
+
+    grid_build(&segment_grid, segment_box, numRecs, &dataset_bounds);
+    grid_build(&polygon_grid, polygon_box, numPolygons, &dataset_bounds);
+}
+
+
+/**
+* Frees the memory allocated by build_spatial_index().
+*/
+void destroy_spatial_index()
+{
+    grid_destroy(&segment_grid);
+    grid_destroy(&polygon_grid);
+
+    // boxes mapped from a pack are released with it
+    if (!in_pack(segment_box))
+        free(segment_box);
+    if (!in_pack(polygon_box))
+        free(polygon_box);
+    segment_box = polygon_box = NULL;
+}
@@ -0,0 +1,417 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+/*
+* Street labels.  While the roads are drawn, the longest visible piece of 
+* every street is remembered in a label set, a hash table keyed on the 
+* street name.  Once the map is drawn the labels are placed in order of 
+* importance (road class, then drawing order), skipping any that would 
+* overlap a label already printed.  Printed labels are kept in a coarse 
+* grid of cells so that only nearby labels need to be checked.  The text 
+* itself comes from the cache in text_cache.c.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "gd.h"
+#include "tmrs.h"
+
+#define LABEL_HASH_SIZE     1024    // buckets of a label set, a power of two
+#define LABEL_CELL_SIZE     64      // pixels along each side of a grid cell
+#define LABEL_PADDING       3       // minimum gap between two labels
+
+
+struct _StreetLabel 
+{
+    int street_index;
+    char road_class;
+    int x1, x2, y1, y2;
+    int segment;            // segment the piece above belongs to
+    int first_segment;      // first segment drawn with this name
+    struct _StreetLabel *next;        // next label of the set
+    struct _StreetLabel *hash_next;   // next label in the same bucket
+};
+
+struct _LabelSet
+{
+    struct _StreetLabel *bucket[LABEL_HASH_SIZE];
+    struct _StreetLabel *head;
+    int count;
+};
+
+// area taken by a printed label
+struct _LabelBox
+{
+    int x1, y1, x2, y2;
+};
+
+// printed labels, indexed by the grid cells they touch
+struct _LabelGrid
+{
+    int cols, rows;
+    int *cell_head;         // first reference of each cell, -1 if none
+    struct _LabelBox *box;
+    int num_boxes;
+    int *ref_box, *ref_next;
+    int num_refs, allocated_refs;
+};
+
+
+/**
+* Returns the square of the distance between two specified points
+*/
+static int length(int x1, int y1, int x2, int y2)
+{
+    int a, b;
+
+    a = x2-x1;
+    b = y2-y1;
+
+    return(a*a + b*b);
+}
+
+
+struct _LabelSet *label_set_create()
+{
+    return (struct _LabelSet *)calloc(1, sizeof(struct _LabelSet));
+}
+
+
+void label_set_destroy(struct _LabelSet *set)
+{
+    struct _StreetLabel *cur_ptr, *next_ptr;
+
+    for (cur_ptr = set->head; cur_ptr != NULL; cur_ptr = next_ptr)
+    {
+        next_ptr = cur_ptr->next;
+        free(cur_ptr);
+    }
+
+    free(set);
+}
+
+
+/**
+* Offers a piece of street, drawn from (x1,y1) to (x2,y2), as the place for 
+* its name.  Only the longest piece of each street is kept; among pieces of 
+* the same length the one from the lowest segment wins, so the outcome does 
+* not depend on the order pieces are offered in.
+*
+* set           - the labels found so far
+* i             - the segment the piece belongs to
+* first_segment - the first segment drawn with this name (normally i)
+*/
+void add_street_label(struct _LabelSet *set, int i, int first_segment, 
+                      int street_index, char road_class, 
+                      int x1, int y1, int x2, int y2)
+{
+    struct _StreetLabel *cur_ptr, *pNode;
+    int temp, d1, d2, hash;
+
+    // swap coordinates if necessary so that label is always printed above 
+    // the street for horizontal cases.
+    if (x2 < x1)
+    {
+        temp = x1;
+        x1 = x2;
+        x2 = temp;
+
+        temp = y1;
+        y1 = y2;
+        y2 = temp;
+    }
+
+    hash = street_index & (LABEL_HASH_SIZE - 1);
+    for (cur_ptr = set->bucket[hash]; cur_ptr != NULL; cur_ptr = cur_ptr->hash_next)
+    {
+        if (cur_ptr->street_index == street_index)
+        {
+            // check if we should replace current with new segment
+            d1 = length(cur_ptr->x1, cur_ptr->y1, cur_ptr->x2, cur_ptr->y2);
+            d2 = length(x1, y1, x2, y2);
+
+            if (d2 > d1 || (d2 == d1 && i < cur_ptr->segment))
+            {
+                cur_ptr->x1 = x1;  cur_ptr->y1 = y1;
+                cur_ptr->x2 = x2;  cur_ptr->y2 = y2;
+                cur_ptr->segment = i;
+            }
+
+            if (first_segment < cur_ptr->first_segment)
+                cur_ptr->first_segment = first_segment;
+            return;
+        }
+    }
+
+    // reached here means we did not encounter this street name before
+    pNode = (struct _StreetLabel *)malloc(sizeof(struct _StreetLabel));
+    pNode->street_index = street_index;
+    pNode->road_class = road_class;
+    pNode->x1 = x1; pNode->y1 = y1;
+    pNode->x2 = x2; pNode->y2 = y2;
+    pNode->segment = i;
+    pNode->first_segment = first_segment;
+
+    pNode->next = set->head;
+    set->head = pNode;
+    pNode->hash_next = set->bucket[hash];
+    set->bucket[hash] = pNode;
+    ++set->count;
+}
+
+
+/**
+* Adds all labels of one set to another, moving them down by dy pixels.  
+* Used to combine the labels found in the bands of a map.
+*/
+void merge_label_set(struct _LabelSet *set, struct _LabelSet *from, int dy)
+{
+    struct _StreetLabel *p;
+
+    for (p = from->head; p != NULL; p = p->next)
+        add_street_label(set, p->segment, p->first_segment, p->street_index, 
+            p->road_class, p->x1, p->y1 + dy, p->x2, p->y2 + dy);
+}
+
+
+/* orders labels by road class, then by when they were first drawn */
+static int compare_labels(const void *a, const void *b)
+{
+    struct _StreetLabel *p = *(struct _StreetLabel **)a;
+    struct _StreetLabel *q = *(struct _StreetLabel **)b;
+
+    if (p->road_class != q->road_class)
+        return p->road_class - q->road_class;
+
+    return p->first_segment - q->first_segment;
+}
+
+
+static void label_grid_init(struct _LabelGrid *grid, int width, int height)
+{
+    int i;
+
+    memset(grid, 0, sizeof(struct _LabelGrid));
+    grid->cols = width / LABEL_CELL_SIZE + 1;
+    grid->rows = height / LABEL_CELL_SIZE + 1;
+    grid->cell_head = (int *)malloc(grid->cols * grid->rows * sizeof(int));
+    for (i = 0; i < grid->cols * grid->rows; i++)
+        grid->cell_head[i] = -1;
+}
+
+
+static void label_grid_destroy(struct _LabelGrid *grid)
+{
+    free(grid->cell_head);
+    free(grid->box);
+    free(grid->ref_box);
+    free(grid->ref_next);
+}
+
+
+/* returns 1 if the box overlaps a label in the grid or comes within 
+   LABEL_PADDING of one */
+static int label_grid_collides(struct _LabelGrid *grid, struct _LabelBox *b)
+{
+    struct _LabelBox *other;
+    int col, row, ref, col1, row1, col2, row2;
+
+    // a label in a neighbouring cell can still be within the padding
+    col1 = (b->x1 > LABEL_PADDING) ? (b->x1 - LABEL_PADDING) / LABEL_CELL_SIZE : 0;
+    row1 = (b->y1 > LABEL_PADDING) ? (b->y1 - LABEL_PADDING) / LABEL_CELL_SIZE : 0;
+    col2 = (b->x2 + LABEL_PADDING) / LABEL_CELL_SIZE;
+    row2 = (b->y2 + LABEL_PADDING) / LABEL_CELL_SIZE;
+    if (col2 >= grid->cols)
+        col2 = grid->cols - 1;
+    if (row2 >= grid->rows)
+        row2 = grid->rows - 1;
+
+    for (row = row1; row <= row2; row++)
+        for (col = col1; col <= col2; col++)
+            for (ref = grid->cell_head[row * grid->cols + col]; ref >= 0; 
+                 ref = grid->ref_next[ref])
+            {
+                other = &grid->box[grid->ref_box[ref]];
+                if (b->x1 <= other->x2 + LABEL_PADDING && other->x1 <= b->x2 + LABEL_PADDING &&
+                    b->y1 <= other->y2 + LABEL_PADDING && other->y1 <= b->y2 + LABEL_PADDING)
+                    return 1;
+            }
+
+    return 0;
+}
+
+
+/* adds a box, which must lie within the image, to the grid */
+static void label_grid_add(struct _LabelGrid *grid, struct _LabelBox *b, 
+                           int max_boxes)
+{
+    int col, row, cell;
+
+    if (grid->box == NULL)
+        grid->box = (struct _LabelBox *)malloc(max_boxes * sizeof(struct _LabelBox));
+    grid->box[grid->num_boxes] = *b;
+
+    for (row = b->y1 / LABEL_CELL_SIZE; row <= b->y2 / LABEL_CELL_SIZE; row++)
+        for (col = b->x1 / LABEL_CELL_SIZE; col <= b->x2 / LABEL_CELL_SIZE; col++)
+        {
+            if (grid->num_refs == grid->allocated_refs)
+            {
+                grid->allocated_refs = grid->allocated_refs * 2 + 64;
+                grid->ref_box = (int *)realloc(grid->ref_box, 
+                    grid->allocated_refs * sizeof(int));
+                grid->ref_next = (int *)realloc(grid->ref_next, 
+                    grid->allocated_refs * sizeof(int));
+            }
+
+            cell = row * grid->cols + col;
+            grid->ref_box[grid->num_refs] = grid->num_boxes;
+            grid->ref_next[grid->num_refs] = grid->cell_head[cell];
+            grid->cell_head[cell] = grid->num_refs++;
+        }
+
+    ++grid->num_boxes;
+}
+
+
+/**
+* Works out where the labels of a set go on a map of the given size, most 
+* important first, leaving out those that would overlap an earlier one or 
+* not fit on the map.  Each label that is kept is handed to print().
+*
+* Returns the number of labels kept.
+*/
+int layout_labels(struct _LabelSet *set, int width, int height, int color, 
+                  void (*print)(void *context, struct _PlacedLabel *placed), 
+                  void *context)
+{
+    struct _StreetLabel **label, *p;
+    struct _PlacedLabel placed;
+    struct _LabelGrid grid;
+    struct _LabelBox box;
+    int x1, x2, y1, y2, i, k, count;
+    int x_pos, y_pos;
+    int *brect;
+    struct _TextImage *text;
+    char str[64];
+    char *f = "./arial.ttf";
+    double angle;
+    float font_size = 10.0;
+
+    if (set->count == 0)
+        return 0;
+
+    label = (struct _StreetLabel **)malloc(set->count * sizeof(struct _StreetLabel *));
+    for (i = 0, p = set->head; p != NULL; p = p->next)
+        label[i++] = p;
+    qsort(label, set->count, sizeof(struct _StreetLabel *), compare_labels);
+
+    label_grid_init(&grid, width, height);
+    count = 0;
+
+    for (i = 0; i < set->count; i++)
+    {
+        x1 = label[i]->x1; 
+        y1 = label[i]->y1;
+        x2 = label[i]->x2; 
+        y2 = label[i]->y2;
+        angle = atan2(y1-y2, x2-x1);
+
+        if (label[i]->road_class < 30)
+            font_size = 12.0;
+        else
+            font_size = 10.0;
+
+        format_street_name(str, label[i]->street_index);
+
+        // figure out the x and y position at which to draw the label
+        text = get_text_image(f, str, font_size, angle, color);
+        if (text == NULL)
+            continue;   // font could not be loaded
+        brect = get_text_brect(text);
+
+        x_pos = x1 + ((x2 - x1) - (brect[2] - brect[0]))/2;
+        if (y2 > y1)
+            y_pos = y1 + ((y2 - y1) - (brect[3] - brect[1]))/2;
+        else
+            y_pos = y2 + ((y1 - y2) - (brect[3] - brect[1]))/2;
+
+        if (angle > 0.0 && angle < 1.6)
+            x_pos -= 4;
+        else
+            x_pos += 4;
+
+        // the corners of the (rotated) text give the area it covers
+        box.x1 = box.x2 = brect[0];
+        box.y1 = box.y2 = brect[1];
+        for (k = 2; k < 8; k += 2)
+        {
+            if (brect[k] < box.x1) box.x1 = brect[k];
+            if (brect[k] > box.x2) box.x2 = brect[k];
+            if (brect[k+1] < box.y1) box.y1 = brect[k+1];
+            if (brect[k+1] > box.y2) box.y2 = brect[k+1];
+        }
+        box.x1 += x_pos;  box.x2 += x_pos;
+        box.y1 += y_pos - 4;  box.y2 += y_pos - 4;
+
+        if (box.x1 < 0 || box.y1 < 0 || box.x2 >= width || box.y2 >= height)
+            continue;
+        if (label_grid_collides(&grid, &box))
+            continue;
+
+        placed.text = str;
+        placed.size = font_size;
+        placed.angle = angle;
+        placed.x = x_pos;
+        placed.y = y_pos - 4;
+        placed.image = text;
+        print(context, &placed);
+
+        label_grid_add(&grid, &box, set->count);
+        ++count;
+    }
+
+    label_grid_destroy(&grid);
+    free(label);
+
+    return count;
+}
+
+
+/* layout_labels() callback printing a label onto the image in context */
+static void print_label(void *context, struct _PlacedLabel *placed)
+{
+    draw_text_image((gdImagePtr)context, placed->image, placed->x, placed->y);
+}
+
+
+/**
+* Prints the labels of a set onto the image, see layout_labels().
+*
+* Returns the number of labels printed.
+*/
+int place_labels(struct _LabelSet *set, gdImagePtr im, int color)
+{
+    return layout_labels(set, im->sx, im->sy, color, print_label, im);
+}
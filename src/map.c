@@ -23,332 +23,672 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "gd.h"
 #include "gdfontmb.h"
 #include "tmrs.h"
 
 
-struct _StreetLabel 
+int streets[16], num_printed;
+
+// one horizontal band of a map drawn by its own thread
+struct _Band
 {
-    int street_index;
-    char road_class;
-    int x1, x2, y1, y2;
-    struct _StreetLabel *next;
+    struct _MapView view;   // band_top and band_height include the overlap
+    int top, height;        // the rows of the map the band is copied into
+    gdImagePtr im;
+    pthread_t thread;
+    int started;            // 1 if drawn by a new thread that must be joined
 };
 
-struct _StreetLabel *head;
-
-int background, minor_street, major_street, highway, black, blue;
-int gray, green;
-int light_gray, dark_gray;
-int streets[16], num_printed;
+static char *backend_name[NUM_BACKENDS] = { "gd", "scanline", "scanline-aa" };
 
 
 /**
-* Returns the square of the distance between two specified points
+* Converts coordinates into a pixel position on the map, or on the band of 
+* it being drawn.
+*
+* view     - the projection and size of the map.
+* &m       - the coordinates to convert.
+* x, y     - set to the pixel position (may lie outside the image).
 */
-int length(int x1, int y1, int x2, int y2)
+void project_point(struct _MapView *view, struct _Coordinates *m, int *x, int *y)
 {
-    int a, b;
-
-    a = x2-x1;
-    b = y2-y1;
+    if (view->projection == PROJECTION_MERCATOR)
+    {
+        *x = (int)floor(mercator_x(m->Longitude, view->zoom) - view->origin_x);
+        *y = (int)floor(mercator_y(m->Latitude, view->zoom) - view->origin_y);
+    }
+    else
+    {
+        *x = view->width/2 + 
+            ((abs(view->center.Longitude) - abs(m->Longitude)) / view->scale);
+        *y = view->height/2 + ((view->center.Latitude - m->Latitude) / view->scale);
+    }
 
-    return(a*a + b*b);
+    // images of a band start at its first row
+    *y -= view->band_top;
 }
 
 
 /**
-* This functions adds a street segment to the linked list.  This list is 
-* traversed at the end of the map drawing and the labels then printed.  
+* Decides how a road of the given class is drawn at the given scale.  Roads 
+* are drawn in two passes: a wide casing first and a narrower fill on top.  
+* A width of 0 skips the pass.
+*
+* Returns 0 if the road is not drawn at all.
 */
-void add_street_label(int i, int x1, int y1, int x2, int y2)
+int get_line_style(char road_class, int scale, struct _LineStyle *style)
 {
-    struct _StreetLabel *cur_ptr, *prev_ptr, *pNode;
-    int temp, d1, d2;
+    memset(style, 0, sizeof(struct _LineStyle));
 
-    // swap coordinates if necessary so that label is always printed above 
-    // the street for horizontal cases.
-    if (x2 < x1)
+    // draw highways as thick red lines
+    if (road_class < 20)
     {
-        temp = x1;
-        x1 = x2;
-        x2 = temp;
+        style->casing_width = 5;  style->casing_color = dark_gray;
+        style->fill_width = 3;    style->fill_color = highway;
+        style->label = 1;
+    }
 
-        temp = y1;
-        y1 = y2;
-        y2 = temp;
+    // draw major streets appropriately based on scale
+    else if (road_class < 30)
+    {
+        if (scale < 400)
+        {
+            style->casing_width = 4;  style->casing_color = dark_gray;
+            style->fill_width = 2;    style->fill_color = major_street;
+            style->label = 1;
+        }
+        else if (scale < 3000)
+        {
+            style->fill_width = 1;    style->fill_color = dark_gray;
+        }
     }
 
-    cur_ptr = head;
-    while (cur_ptr != NULL)
+    // draw minor streets (if at all) based on scale
+    else if (road_class < 70)
     {
-        if (cur_ptr->street_index == segment[i].StreetIndex)
+        if (scale < 30)
+        {
+            style->casing_width = 4;  style->casing_color = dark_gray;
+            style->fill_width = 2;    style->fill_color = light_gray;
+            style->label = 1;
+        }
+        else if (scale < 400)
         {
-            // check if we should replace current with new segment
-            d1 = length(cur_ptr->x1, cur_ptr->y1, cur_ptr->x2, cur_ptr->y2);
-            d2 = length(x1, y1, x2, y2);
-
-            if (d2 > d1)
-            {
-                cur_ptr->x1 = x1;  cur_ptr->y1 = y1;
-                cur_ptr->x2 = x2;  cur_ptr->y2 = y2;
-            }
-            //printf("replaced street\n");
-            return;
+            style->fill_width = 1;    style->fill_color = dark_gray;
         }
-        cur_ptr = cur_ptr->next;
     }
 
-    // reached here means we did not encounter this street name before
-    pNode = (struct _StreetLabel *)malloc(sizeof(struct _StreetLabel));
-    pNode->street_index = segment[i].StreetIndex;
-    pNode->road_class = segment[i].RoadClass;
-    pNode->x1 = x1; pNode->y1 = y1;
-    pNode->x2 = x2; pNode->y2 = y2;
-    pNode->next = NULL;
-
-    // handle situation where this is the first node in list
-    //printf("Adding street\n");
-    if (head == NULL)
+    // this is a water boundary
+    else if (road_class == 127)
+    {
+        style->fill_width = 1;    style->fill_color = blue;
+    }
+
+    return style->casing_width > 0 || style->fill_width > 0;
+}
+
+
+/**
+* Draws a projected chain as one polyline.  Thick lines get round joins 
+* (and caps, so that chains meeting at an intersection blend together) by 
+* stamping a disc on every vertex.
+*/
+void draw_polyline(struct _MapView *view, gdImagePtr im, gdPoint *points, 
+                   int num_points, int width, int color)
+{
+    int j;
+
+    if (view->raster != NULL)
     {
-        head = pNode;
+        raster_polyline(view->raster, points, num_points, width, color);
         return;
     }
 
-    // insert node at the correct point sorted by RoadClass
-    cur_ptr = head;
-    prev_ptr = cur_ptr;
-    while (cur_ptr != NULL)
+    gdImageSetThickness(im, width);
+    if (num_points == 1)
+        gdImageSetPixel(im, points[0].x, points[0].y, color);
+    else
+        gdImageOpenPolygon(im, points, num_points, color);
+
+    if (width > 2)
+        for (j = 0; j < num_points; j++)
+            gdImageFilledEllipse(im, points[j].x, points[j].y, width, width, color);
+}
+
+
+/**
+* Clips the line from (x1,y1) to (x2,y2) to the rectangle from (0,0) to 
+* (width,height).  Returns 0 if nothing of it is left.
+*/
+static int clip_line(int *x1, int *y1, int *x2, int *y2, int width, int height)
+{
+    double t0 = 0.0, t1 = 1.0, t;
+    double dx = *x2 - *x1, dy = *y2 - *y1;
+    double p[4], q[4];
+    int k;
+
+    p[0] = -dx;  q[0] = *x1;
+    p[1] = dx;   q[1] = width - *x1;
+    p[2] = -dy;  q[2] = *y1;
+    p[3] = dy;   q[3] = height - *y1;
+
+    for (k = 0; k < 4; k++)
     {
-        if (pNode->road_class < cur_ptr->road_class)
+        if (p[k] == 0.0)
         {
-            pNode->next = cur_ptr;
-            if (cur_ptr == head)
-                head = pNode;
-            else
-                prev_ptr->next = pNode;
-            return;
+            if (q[k] < 0.0)
+                return 0;
+            continue;
         }
 
-        prev_ptr = cur_ptr;
-        cur_ptr = cur_ptr->next;
+        t = q[k] / p[k];
+        if (p[k] < 0.0 && t > t0)
+            t0 = t;
+        else if (p[k] > 0.0 && t < t1)
+            t1 = t;
     }
 
-    // we reached the end of the list, so this node has largest F-Value
-    prev_ptr->next = pNode;
+    if (t0 > t1)
+        return 0;
+
+    dx = *x1 + t1 * dx;
+    dy = *y1 + t1 * dy;
+    *x1 = (int)floor(*x1 + t0 * (*x2 - *x1) + 0.5);
+    *y1 = (int)floor(*y1 + t0 * (*y2 - *y1) + 0.5);
+    *x2 = (int)floor(dx + 0.5);
+    *y2 = (int)floor(dy + 0.5);
+
+    return 1;
 }
 
 
 /**
-* This function draws a line based on the information passed to it.
+* Adds the pieces of a projected chain that cross the map as label 
+* candidates for segment i.  Pieces are cut off at the edges of the map 
+* (not of the band) so that labels end up on the visible part of a street.
+*/
+void add_chain_labels(struct _MapView *view, int i, gdPoint *points, 
+                      int num_points)
+{
+    int j, x1, y1, x2, y2;
+
+    for (j = 0; j < num_points-1; j++)
+    {
+        x1 = points[j].x;    y1 = points[j].y + view->band_top;
+        x2 = points[j+1].x;  y2 = points[j+1].y + view->band_top;
+
+        if (clip_line(&x1, &y1, &x2, &y2, view->width - 1, view->height - 1))
+            add_street_label(view->labels, i, i, segment_street[i], 
+                segment_class[i], x1, y1 - view->band_top, 
+                x2, y2 - view->band_top);
+    }
+}
+
+
+/**
+* Returns the fill color of a polygon of the given type.
+*/
+int get_polygon_color(char type)
+{
+    if (type == POLYGON_WATER)  
+        return blue;
+    else if (type == POLYGON_AIRPORT)
+        return gray;
+
+    return green;
+}
+
+
+/* makes sure view->clip_point[k] has room for n points, keeping its content */
+static gdPoint *get_clip_buffer(struct _MapView *view, int k, int n)
+{
+    if (n > view->clip_allocated[k])
+    {
+        view->clip_allocated[k] = n + n/2;
+        view->clip_point[k] = (gdPoint *)realloc(view->clip_point[k], 
+            view->clip_allocated[k] * sizeof(gdPoint));
+    }
+
+    return view->clip_point[k];
+}
+
+
+/* 
+* One pass of the Sutherland-Hodgman algorithm: clips the polygon in[] to 
+* the side of the line x = limit (axis 0) or y = limit (axis 1) given by 
+* keep, +1 for the side above the limit and -1 for the side below it.  The 
+* result, at most 2n points, is stored in out[].
 *
-* &c       - a pointer to the coordinates on which to center the map.
-* scale    - the scale of the map.  Good range is 10 to 2000.
-* road_class - the type of road.  This is used to draw using appropriate 
-*              colors and width.
-* im       - the image on which to draw.
+* Returns the number of points stored.
 */
-void draw_line(struct _Coordinates *c, struct _Coordinates *m, struct _Coordinates *n,
-               int scale, int i, gdImagePtr im)
+static int clip_polygon_edge(gdPoint *in, int n, gdPoint *out, 
+                             int axis, int limit, int keep)
 {
-    int x1, y1, x2, y2, k;
+    gdPoint *a, *b;
+    int i, count, a_in, b_in, a_pos, b_pos, a_other, b_other, other;
 
-    x1 = im->sx/2 + ((abs(c->Longitude) - abs(m->Longitude)) / scale);
-    y1 = im->sy/2 + ((c->Latitude - m->Latitude) / scale);
-    x2 = im->sx/2 + ((abs(c->Longitude) - abs(n->Longitude)) /scale);
-    y2 = im->sy/2 + ((c->Latitude - n->Latitude) / scale);
+    count = 0;
+    a = &in[n-1];
+    a_pos = axis ? a->y : a->x;
+    a_in = ((a_pos - limit) * keep >= 0);
 
-    // draw only if line intersects the image window
-    if ((CONTAINS(0,im->sx,x1) && CONTAINS(0, im->sy, y1)) || 
-        (CONTAINS(0,im->sx,x2) && CONTAINS(0, im->sy, y2)))
+    for (i = 0; i < n; i++)
     {
-        // draw highways as thick red lines
-        if (segment[i].RoadClass < 20)
-        {
-            gdImageSetThickness(im, 5);
-            gdImageLine(im, x1, y1, x2, y2, dark_gray);
-            gdImageSetThickness(im, 3);
-            gdImageLine(im, x1, y1, x2, y2, highway);
-            add_street_label(i,x1,y1,x2,y2);
-        }
+        b = &in[i];
+        b_pos = axis ? b->y : b->x;
+        b_in = ((b_pos - limit) * keep >= 0);
 
-        // draw major streets appropriately based on scale
-        else if (segment[i].RoadClass < 30)
+        // add the point where the edge crosses the line
+        if (a_in != b_in)
         {
-            if (scale < 400)
-            {
-                gdImageSetThickness(im, 4);
-                gdImageLine(im, x1, y1, x2, y2, dark_gray);
-                gdImageSetThickness(im, 2);
-                gdImageLine(im, x1, y1, x2, y2, major_street);
-                add_street_label(i,x1,y1,x2,y2);
-            }
-            else if (scale < 3000)
-            {
-                gdImageSetThickness(im, 1);
-                gdImageLine(im, x1, y1, x2, y2, dark_gray);
-            }
+            a_other = axis ? a->x : a->y;
+            b_other = axis ? b->x : b->y;
+            other = a_other + (int)floor((double)(b_other - a_other) * 
+                (limit - a_pos) / (b_pos - a_pos) + 0.5);
+            out[count].x = axis ? other : limit;
+            out[count].y = axis ? limit : other;
+            ++count;
         }
 
-        // draw minor streets (if at all) based on scale
-        else if (segment[i].RoadClass < 70)
-        {
-            if (scale < 30)
-            {
-                gdImageSetThickness(im, 4);
-                gdImageLine(im, x1, y1, x2, y2, dark_gray);
-                gdImageSetThickness(im, 2);
-                gdImageLine(im, x1, y1, x2, y2, light_gray);
-                add_street_label(i,x1,y1,x2,y2);
-            }
-            else if (scale < 400)
-            {
-                gdImageSetThickness(im, 1);
-                gdImageLine(im, x1, y1, x2, y2, dark_gray);
-                //add_street_label(i,x1,y1,x2,y2);
-            }
-        }
+        if (b_in)
+            out[count++] = *b;
 
-        // this is a water boundary
-        else if (segment[i].RoadClass == 127)
-        {
-            gdImageSetThickness(im, 1);
-            gdImageLine(im, x1, y1, x2, y2, blue);
-        }
+        a = b;
+        a_pos = b_pos;
+        a_in = b_in;
     }
+
+    return count;
 }
 
+
 /**
 * This function draws a filled polygon based on the information passed to it.
+* Polygons reaching past the map are clipped to it first, so that a bay or 
+* lake much larger than the map costs no more than what is visible of it.
 *
-* &c       - a pointer to the coordinates on which to center the map.
-* scale    - the scale of the map.  Good range is 10 to 2000.
+* view     - the projection and scale of the map.
 * &p       - pointer to a polygon structure.
 * im       - the image on which to draw.
 */
-void draw_polygon(struct _Coordinates *c, struct _Polygon *p, int scale, 
-                  gdImagePtr im)
+void draw_polygon(struct _MapView *view, struct _Polygon *p, gdImagePtr im)
 {
-    int i, x, y, color;
-    struct _Coordinates *m;
+    int i, n, k, color, outside;
+    int limit[4], axis[4] = { 0, 0, 1, 1 }, keep[4] = { 1, -1, 1, -1 };
     gdPoint *gp;
 
-    gp = (gdPoint *)malloc(p->num_points * sizeof(gdPoint));
+    limit[0] = -CLIP_MARGIN;
+    limit[1] = view->width - 1 + CLIP_MARGIN;
+    // the whole map rather than the band, so that every band cuts a polygon 
+    // in the same place
+    limit[2] = -view->band_top - CLIP_MARGIN;
+    limit[3] = view->height - 1 - view->band_top + CLIP_MARGIN;
 
+    gp = get_clip_buffer(view, 0, p->num_points);
+    outside = 0;
     for (i = 0; i < p->num_points; i++)
     {
-        m = &p->point[i];
-        x = im->sx/2 + ((abs(c->Longitude) - abs(m->Longitude)) / scale);
-        y = im->sy/2 + ((c->Latitude - m->Latitude) / scale);
+        project_point(view, &p->point[i], &gp[i].x, &gp[i].y);
+        if (gp[i].x < limit[0] || gp[i].x > limit[1] || 
+            gp[i].y < limit[2] || gp[i].y > limit[3])
+            outside = 1;
+    }
+
+    // clip against the left, right, top and bottom edges in turn
+    n = p->num_points;
+    k = 0;
+    for (i = 0; outside && i < 4 && n > 0; i++)
+    {
+        get_clip_buffer(view, 1-k, 2*n);
+        n = clip_polygon_edge(view->clip_point[k], n, view->clip_point[1-k], 
+            axis[i], limit[i], keep[i]);
+        k = 1-k;
+    }
+
+    if (n < 3)
+        return;
+
+    gp = view->clip_point[k];
+    color = get_polygon_color(p->type);
+
+    if (view->raster != NULL)
+        raster_polygon(view->raster, gp, n, color);
+    else
+        gdImageFilledPolygon(im, gp, n, color);
+}
+
+
+/**
+* Projects a road segment, including its shape points, into pixel positions 
+* starting at points[0].  Points that land on the same pixel as the one 
+* before are dropped.  The shape points come from the detail level chosen 
+* for the view; simplification may have left none, in which case the 
+* segment is a straight line.
+*
+* Returns the number of points stored, at most get_segment_points(i).
+*/
+int project_segment(int i, struct _MapView *view, gdPoint *points)
+{
+    int num_points, shapeIndex, j, n;
+    struct _Coordinates *point = NULL;
+
+    num_points = 0;
+    shapeIndex = segment_shape[i];
+    if (shapeIndex >= 0)
+    {
+        num_points = CHAIN_LENGTH(shape_level[view->detail], shapeIndex);
+        point = CHAIN_POINTS(shape_level[view->detail], shapeIndex);
+    }
+
+    project_point(view, &segment_start[i], &points[0].x, &points[0].y);
+    n = 1;
+
+    for (j = 0; j <= num_points; j++)
+    {
+        if (j < num_points)
+            project_point(view, &point[j], &points[n].x, &points[n].y);
+        else
+            project_point(view, &segment_end[i], &points[n].x, &points[n].y);
 
-        gp[i].x = x;
-        gp[i].y = y;
+        if (points[n].x != points[n-1].x || points[n].y != points[n-1].y)
+            ++n;
     }
 
-    // select appropriate color
-    if (p->type == POLYGON_WATER)  
-        color = blue;
-    else if (p->type == POLYGON_AIRPORT)
-        color = gray;
-    else 
-        color = green;
+    return n;
+}
+
 
-    gdImageFilledPolygon(im, gp, p->num_points, color);
-    free(gp);
+/**
+* Returns the number of points project_segment() may store for segment i at 
+* the given detail level.
+*/
+int get_segment_points(int i, int detail)
+{
+    if (segment_shape[i] < 0)
+        return 2;
+
+    return CHAIN_LENGTH(shape_level[detail], segment_shape[i]) + 2;
 }
 
 
 /**
-* This function draw a specified road segment.  If it happens to contain 
-* shape points, then each sub-segment will be drawn separately.
+* Draws one group of road segments.  Every segment is projected once into 
+* a shared point buffer, then all casings are drawn followed by all fills so 
+* that the fill of one segment is not cut by the casing of the next.
+*
+* visible  - the segments to draw, all from the same group.
+* count    - the number of segments in visible.
 */
-void draw_segment(int i, struct _Coordinates *c, int scale, gdImagePtr im)
+void draw_segment_group(struct _MapView *view, gdImagePtr im, int *visible, 
+                        int count)
 {
-    int num_points, shapeIndex, j;
-    struct _Coordinates *point;  
+    struct _LineStyle *style;
+    gdPoint *points;
+    int *first;
+    int j, n, total;
+
+    style = (struct _LineStyle *)malloc(count * sizeof(struct _LineStyle));
+    first = (int *)malloc((count+1) * sizeof(int));
 
-    shapeIndex = segment[i].ShapeIndex;
-    if (shapeIndex < 0)
+    // work out which segments get drawn and how much room they need
+    total = 0;
+    for (j = 0; j < count; j++)
     {
-        draw_line(c, &segment[i].StartPoint, &segment[i].EndPoint, 
-            scale, i, im);
+        if (get_line_style(segment_class[visible[j]], view->scale, &style[j]))
+            total += get_segment_points(visible[j], view->detail);
+    }
+
+    points = (gdPoint *)malloc(total * sizeof(gdPoint));
+
+    // project each chain once
+    n = 0;
+    for (j = 0; j < count; j++)
+    {
+        first[j] = n;
+        if (style[j].casing_width > 0 || style[j].fill_width > 0)
+            n += project_segment(visible[j], view, &points[n]);
+    }
+    first[count] = n;
+
+    for (j = 0; j < count; j++)
+    {
+        if (style[j].casing_width > 0)
+            draw_polyline(view, im, &points[first[j]], first[j+1] - first[j], 
+                style[j].casing_width, style[j].casing_color);
+    }
+
+    for (j = 0; j < count; j++)
+    {
+        if (style[j].fill_width > 0)
+            draw_polyline(view, im, &points[first[j]], first[j+1] - first[j], 
+                style[j].fill_width, style[j].fill_color);
+
+        if (style[j].label)
+            add_chain_labels(view, visible[j], &points[first[j]], first[j+1] - first[j]);
+    }
+
+    free(points);
+    free(first);
+    free(style);
+}
+
+
+/**
+* Returns the most simplified detail level that stays within half a pixel of 
+* the real geometry at the given scale.
+*/
+int get_detail_level(int scale)
+{
+    int level = 0;
+
+    while (level+1 < NUM_DETAIL_LEVELS && 2 * DETAIL_TOLERANCE(level+1) <= scale)
+        ++level;
+
+    return level;
+}
+
+
+/**
+* Looks up a rendering backend by name.  Returns -1 if there is none.
+*/
+int get_backend(char *name)
+{
+    int i;
+
+    for (i = 0; i < NUM_BACKENDS; i++)
+        if (strcmp(name, backend_name[i]) == 0)
+            return i;
+
+    return -1;
+}
+
+
+char *get_backend_name(int backend)
+{
+    return backend_name[backend];
+}
+
+
+/**
+* Computes the area covered by the band of a map being drawn.  This is the 
+* inverse of project_point(), padded by a few pixels so that lines ending 
+* just outside the window are still considered.
+*/
+void get_map_bounds(struct _MapView *view, struct _BoundingBox *box)
+{
+    int margin = 8;
+    int west, east, scale, top, bottom;
+
+    top = view->band_top - margin;
+    bottom = view->band_top + view->band_height + margin;
+
+    if (view->projection == PROJECTION_MERCATOR)
+    {
+        box->Min.Longitude = mercator_longitude(view->origin_x - margin, view->zoom);
+        box->Max.Longitude = mercator_longitude(view->origin_x + view->width + margin, 
+            view->zoom);
+        box->Max.Latitude = mercator_latitude(view->origin_y + top, view->zoom);
+        box->Min.Latitude = mercator_latitude(view->origin_y + bottom, view->zoom);
+        return;
+    }
+
+    // longitudes are projected by their absolute value
+    scale = view->scale;
+    west = abs(view->center.Longitude) + (view->width/2 + margin) * scale;
+    east = abs(view->center.Longitude) - (view->width - view->width/2 + margin) * scale;
+
+    if (view->center.Longitude < 0)
+    {
+        box->Min.Longitude = -west;
+        box->Max.Longitude = -east;
     }
     else
     {
-        num_points = shape[shapeIndex].num_points;
-        point = shape[shapeIndex].point;
+        box->Min.Longitude = east;
+        box->Max.Longitude = west;
+    }
 
-        draw_line(c, &segment[i].StartPoint, &point[0], scale, i, im);
+    box->Min.Latitude = view->center.Latitude - (bottom - view->height/2) * scale;
+    box->Max.Latitude = view->center.Latitude + (view->height/2 - top) * scale;
+}
+
+
+/**
+* Draws the route of the view as a wide line over the roads.
+*/
+static void draw_route(struct _MapView *view, gdImagePtr im)
+{
+    gdPoint *points;
+    int j, n, max_points;
 
-        for (j = 0; j < shape[shapeIndex].num_points-1; j++)
-            draw_line(c,&point[j], &point[j+1], scale, i, im);
+    max_points = 0;
+    for (j = 0; j < view->route_length; j++)
+        if (get_segment_points(view->route[j], view->detail) > max_points)
+            max_points = get_segment_points(view->route[j], view->detail);
 
-        draw_line(c, &point[num_points-1], &segment[i].EndPoint, scale, i, im);
+    points = (gdPoint *)malloc(max_points * sizeof(gdPoint));
+    for (j = 0; j < view->route_length; j++)
+    {
+        n = project_segment(view->route[j], view, points);
+        draw_polyline(view, im, points, n, ROUTE_WIDTH, route_color);
     }
+    free(points);
 }
 
 
 /**
-* This function outputs the image in a raw format to the specified sink. The 
-* sink is generally stdio or a socket.  The size of the output is 
-*
-*    total_bytes = width * height * 4 bytes
-*
-* i.e. 4 bytes / pixel  ( R G B A )
+* Draws the polygons and streets of one band of the map onto an image of the 
+* band's size.  Label candidates are collected in view->labels.
 */
-void image_raw_to_sink(gdImagePtr im, gdSinkPtr pSink)
+static void draw_band(struct _MapView *view, gdImagePtr im)
 {
-    int i, nbytes, nwritten, res;
+    int j, count, *visible, group, first;
+    struct _BoundingBox box;
+
+    gdImageFilledRectangle(im, 0, 0, view->width, view->band_height, background);
 
-    nbytes = im->sx * sizeof(int);  // true color = 4 bytes/pixel
+    // only look at what falls within the map window
+    get_map_bounds(view, &box);
+    view->detail = get_detail_level(view->scale);
 
-    for (i = 0; i < im->sy; i++)
+    view->raster = NULL;
+    view->clip_point[0] = view->clip_point[1] = NULL;
+    view->clip_allocated[0] = view->clip_allocated[1] = 0;
+    if (render_backend != BACKEND_GD)
+        view->raster = raster_create(im, view->band_top, 
+            render_backend == BACKEND_SCANLINE_AA);
+
+    /* draw the filled water polygons first */
+    count = grid_query(&polygon_grid, &box, polygon_box, &visible);
+    for (j = 0; j < count; j++)
+        draw_polygon(view, &polygon_level[view->detail][visible[j]], im);
+    free(visible);
+
+    /* 
+    * draw small streets and water first, then major streets and highways on 
+    * top.  Segments are stored in that order (see group_segments()) and the 
+    * grid returns them sorted, so each group is a run of the visible list.
+    */
+    count = grid_query(&segment_grid, &box, segment_box, &visible);
+    j = 0;
+    for (group = 0; group < NUM_GROUPS; group++)
     {
-        nwritten = 0;
-        while (nwritten < nbytes) {
-            res = pSink->sink(pSink->context, &im->tpixels[i][nwritten], 
-                (im->sx - nwritten) * sizeof(int));
-            if (res < 0) return;  //error occurred
-            nwritten += res;
-        }
+        first = j;
+        while (j < count && visible[j] < group_start[group+1])
+            ++j;
+
+        if (j > first)
+            draw_segment_group(view, im, &visible[first], j - first);
     }
+
+    free(visible);
+
+    // the route goes over the roads but under the labels
+    if (view->route != NULL)
+        draw_route(view, im);
+
+    if (view->raster != NULL)
+    {
+        raster_destroy(view->raster);
+        view->raster = NULL;
+    }
+
+    free(view->clip_point[0]);
+    free(view->clip_point[1]);
+}
+
+
+/* thread entry point rendering one band into its own image */
+static void *band_thread(void *arg)
+{
+    struct _Band *band = (struct _Band *)arg;
+
+    band->im = gdImageCreateTrueColor(band->view.width, band->view.band_height);
+    band->view.labels = label_set_create();
+    draw_band(&band->view, band->im);
+
+    return NULL;
 }
 
 
 /**
-* Starting point of a map-drawing operation.  
-*
-* format - the output file type: RAW or PNG
-* width - the width of the output image
-* height - the height of the output image
-* &c  - the coordinates on which to center the map
-* scale - the scale of the map.  try ranges of 10 to 3000
+* Returns the number of bands a map of the given height is drawn in.  gd 
+* clips every line against the size of the image before drawing it, so a 
+* line crossing the edge of a band would come out a pixel off here and there 
+* from the same line drawn onto the whole map; maps drawn with gd are not 
+* split.
 */
-int draw_map(char *format, int width, int height, struct _Coordinates *c, 
-             int scale, gdSink *pSink) 
+static int get_band_count(int height)
 {
-    gdImagePtr im;
-    FILE *pngout;
-    int i, x1, x2, y1, y2, label_count;
-    int x_pos, y_pos;
-    struct _StreetLabel *prev_ptr;
-    int brect[8];
-    char str[64];
-    char *f = "./arial.ttf";
-    double angle;
-    float font_size = 10.0;
-
-    FILE *fp;
-    int j;
+    int count;
+
+    if (render_backend == BACKEND_GD)
+        return 1;
 
+    count = render_threads;
+    if (count < 1)
+        count = sysconf(_SC_NPROCESSORS_ONLN);
 
-    head = NULL;
-    num_printed = 0;
+    if (count > height / MIN_BAND_HEIGHT)
+        count = height / MIN_BAND_HEIGHT;
+    if (count > MAX_BANDS)
+        count = MAX_BANDS;
+
+    return (count < 1) ? 1 : count;
+}
 
-    im = gdImageCreateTrueColor(width, height);
 
+/**
+* Sets the colors of the map style.
+*/
+void init_map_colors()
+{
     background = gdTrueColor(254, 247, 230);
     light_gray = gdTrueColor(238, 238, 238);
     dark_gray = gdTrueColor(164, 164, 164);
@@ -358,87 +698,187 @@ int draw_map(char *format, int width, int height, struct _Coordinates *c,
     blue = gdTrueColor(166, 202, 240);
     green = gdTrueColor(156, 211, 156);
     gray = gdTrueColor(192,192,192);
+    route_color = gdTrueColor(112, 64, 224);
+}
 
-    gdImageFilledRectangle(im, 0, 0, width, height, background);
 
-    /* draw the filled water polygons first */
-    for (i = 0; i < numPolygons; i++)
-        draw_polygon(c, &polygon[i], scale, im);
+/**
+* Draws the polygons, streets and labels that fall within the given view 
+* onto a new image.  The caller must destroy the returned image.
+*
+* Large maps are split into horizontal bands drawn by separate threads 
+* (see the -j option), each onto its own image since gd keeps drawing state 
+* such as the line thickness in the image.  Every band is drawn BAND_OVERLAP 
+* rows further up and down than it reaches, so that wide lines and line ends 
+* just outside it are drawn as they are on the whole map.  The bands are then 
+* copied into place without those rows and the labels, which may cross 
+* bands, are printed last.  The map comes out the same for any number of 
+* bands.  Only the scanline backends are drawn in bands, see get_band_count().
+*/
+gdImagePtr render_map(struct _MapView *view)
+{
+    gdImagePtr im;
+    struct _Band band[MAX_BANDS];
+    struct _BoundingBox box;
+    int i, j, num_bands, top, bottom;
+
+    init_map_colors();
+    im = gdImageCreateTrueColor(view->width, view->height);
+
+    view->band_top = 0;
+    view->band_height = view->height;
+    view->labels = label_set_create();
 
-    /* draw small streets and water first */
-    for (i = 0; i < numRecs; i++)
+    get_map_bounds(view, &box);
+    use_regions(&box);
+
+    num_bands = get_band_count(view->height);
+    if (num_bands == 1)
     {
-        if (segment[i].RoadClass < 30) continue;
-        draw_segment(i, c, scale,im );
+        draw_band(view, im);
+        place_labels(view->labels, im, black);
+        label_set_destroy(view->labels);
+        view->labels = NULL;
+        return im;
     }
 
-    /* draw major streets */
-    for (i = 0; i < numRecs; i++)
+    // split the rows evenly, the first band is drawn by this thread
+    top = 0;
+    for (i = 0; i < num_bands; i++)
     {
-        if (segment[i].RoadClass < 20 || segment[i].RoadClass > 29) continue;
-        draw_segment(i, c, scale,im );   
-    } 
+        band[i].top = top;
+        band[i].height = (view->height - top) / (num_bands - i);
+        top += band[i].height;
+
+        bottom = band[i].top + band[i].height + BAND_OVERLAP;
+        if (bottom > view->height)
+            bottom = view->height;
+
+        band[i].view = *view;
+        band[i].view.band_top = band[i].top - BAND_OVERLAP;
+        if (band[i].view.band_top < 0)
+            band[i].view.band_top = 0;
+        band[i].view.band_height = bottom - band[i].view.band_top;
+
+        band[i].started = 0;
+        if (i > 0)
+        {
+            if (pthread_create(&band[i].thread, NULL, band_thread, &band[i]) == 0)
+                band[i].started = 1;
+            else
+                band_thread(&band[i]);    // no thread, draw it here after all
+        }
+    }
+
+    band_thread(&band[0]);
 
-    /* draw highways */
-    for (i = 0; i < numRecs; i++)
+    // copy the bands into place and gather their labels
+    for (i = 0; i < num_bands; i++)
     {
-        if (segment[i].RoadClass >= 20) continue;
-        draw_segment(i, c, scale,im );       
+        if (band[i].started)
+            pthread_join(band[i].thread, NULL);
+
+        for (j = 0; j < band[i].height; j++)
+            memcpy(im->tpixels[band[i].top + j], 
+                band[i].im->tpixels[band[i].top - band[i].view.band_top + j], 
+                view->width * sizeof(int));
+        gdImageDestroy(band[i].im);
+
+        merge_label_set(view->labels, band[i].view.labels, band[i].view.band_top);
+        label_set_destroy(band[i].view.labels);
     }
 
-    /* now draw the labels and destroy linked list at the same time */
-    // destroy the linked list
-    label_count = 0;  // don't print more than 5 labels
-    prev_ptr = head;
-    while (head != NULL)
-    {
-        head = head->next;
-        ++label_count;
+    place_labels(view->labels, im, black);
+    label_set_destroy(view->labels);
+    view->labels = NULL;
 
-        if (label_count < 5)
-        {
-            x1 = prev_ptr->x1; 
-            y1 = prev_ptr->y1;
-            x2 = prev_ptr->x2; 
-            y2 = prev_ptr->y2;
-            angle = atan2(y1-y2, x2-x1);
+    return im;
+}
 
 
-            if (prev_ptr->road_class < 30)
-                font_size = 12.0;
-            else
-                font_size = 10.0;
+/* draws a linear map view and sends it to the sink in the given format */
+static int output_map(char *format, struct _MapView *view, gdSink *pSink)
+{
+    gdImagePtr im;
 
-            format_street_name(str, prev_ptr->street_index);
-            //printf("%s - %f \n", str, angle);
+    // vector output is written straight to the sink, without an image
+    if (strcmp(format, "SVG") == 0)
+        return draw_map_svg(view, pSink);
 
-            // figure out the x and y position at which to draw the label
-            gdImageStringFT(NULL,&brect[0],0,f,font_size,angle, 0, 0, str);
+    im = render_map(view);
+    image_to_sink(im, format, pSink);
+    gdImageDestroy(im);
 
-            x_pos = x1 + ((x2 - x1) - (brect[2] - brect[0]))/2;
-            if (y2 > y1)
-                y_pos = y1 + ((y2 - y1) - (brect[3] - brect[1]))/2;
-            else
-                y_pos = y2 + ((y1 - y2) - (brect[3] - brect[1]))/2;
+    return 0;
+}
 
-            if (angle > 0.0 && angle < 1.6)
-                x_pos -= 4;
-            else
-                x_pos += 4;
 
-            gdImageStringFT(im,&brect[0],black,f,font_size,angle,x_pos, y_pos-4, str);
-        }
+/**
+* Starting point of a map-drawing operation.  
+*
+* format - the output file type, see encode.c, or SVG
+* width - the width of the output image
+* height - the height of the output image
+* &c  - the coordinates on which to center the map
+* scale - the scale of the map.  try ranges of 10 to 3000
+*/
+int draw_map(char *format, int width, int height, struct _Coordinates *c, 
+             int scale, gdSink *pSink) 
+{
+    struct _MapView view;
+
+    view.projection = PROJECTION_LINEAR;
+    view.width = width;
+    view.height = height;
+    view.center = *c;
+    view.scale = scale;
+    view.route = NULL;
+    view.route_length = 0;
+
+    return output_map(format, &view, pSink);
+}
 
-        free(prev_ptr);
-        prev_ptr = head;
-        //printf("deleted street %d %d\n", x1, y1);
-    }
 
-    if (strcmp(format, "PNG") == 0)
-        gdImagePngToSink(im, pSink);
-    else {
-        image_raw_to_sink(im, pSink);
+/**
+* Draws a map showing a route.  The map is centered on the route and scaled 
+* so that all of it fits, leaving ROUTE_MARGIN pixels free along the edges.
+*
+* format - the output file type, see draw_map()
+* width, height - the size of the output image
+* route - the segments of the route, see find_shortest_path()
+* count - the number of segments in route
+*/
+int draw_route_map(char *format, int width, int height, int *route, int count, 
+                   gdSink *pSink)
+{
+    struct _MapView view;
+    struct _BoundingBox box;
+    int j, scale_x, scale_y;
+
+    box = segment_box[route[0]];
+    for (j = 1; j < count; j++)
+    {
+        extend_box(&box, &segment_box[route[j]].Min);
+        extend_box(&box, &segment_box[route[j]].Max);
     }
 
-    gdImageDestroy(im);
+    view.projection = PROJECTION_LINEAR;
+    view.width = width;
+    view.height = height;
+    view.center.Longitude = box.Min.Longitude + 
+        (box.Max.Longitude - box.Min.Longitude) / 2;
+    view.center.Latitude = box.Min.Latitude + 
+        (box.Max.Latitude - box.Min.Latitude) / 2;
+
+    // round up so that the route is never cut off
+    scale_x = (box.Max.Longitude - box.Min.Longitude) / 
+        (width > 2 * ROUTE_MARGIN ? width - 2 * ROUTE_MARGIN : 1) + 1;
+    scale_y = (box.Max.Latitude - box.Min.Latitude) / 
+        (height > 2 * ROUTE_MARGIN ? height - 2 * ROUTE_MARGIN : 1) + 1;
+    view.scale = (scale_x > scale_y) ? scale_x : scale_y;
+
+    view.route = route;
+    view.route_length = count;
+
+    return output_map(format, &view, pSink);
 }
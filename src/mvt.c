@@ -0,0 +1,466 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+/*
+* Vector tiles in the Mapbox Vector Tile format (version 2), requested as 
+* format "MVT" of a 'T' request.  Clients that draw on the device get the 
+* road geometry of a tile instead of its pixels:
+*
+*   layer "roads", one (Multi)LineString feature per street and road class 
+*   with the segments shown at the zoom level.  The tags are "class" (the 
+*   road class) and "street" (the index into names.dat, left out for 
+*   unnamed roads).  Segments that continue one another are joined into a 
+*   single line.
+*
+* Coordinates are tile pixels times 16 (an extent of 4096) relative to the 
+* top left corner, delta and zigzag encoded as the format requires.  Lines 
+* are clipped to the tile plus a margin of BUFFER_UNITS so that clients can 
+* join neighbouring tiles without seams.
+*
+* The protobuf encoding is written by hand; only the few message types of 
+* vector_tile.proto that are used here are supported.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "gd.h"
+#include "tmrs.h"
+
+
+#define EXTENT          4096            // units along each side of a tile
+#define UNITS_SHIFT     4               // EXTENT = TILE_SIZE << UNITS_SHIFT
+#define BUFFER_UNITS    64              // margin kept around the tile
+
+// protobuf wire types
+#define WIRE_VARINT     0
+#define WIRE_BYTES      2
+
+// geometry commands
+#define CMD_MOVE_TO     1
+#define CMD_LINE_TO     2
+
+// keys of the feature tags
+#define KEY_CLASS       0
+#define KEY_STREET      1
+static char *tag_key[] = { "class", "street" };
+
+
+// maps tag values (road classes and street indexes, never negative) to 
+// their place in the layer's value table
+struct _ValueTable
+{
+    int *key;               // hash of the values seen, -1 for a free slot
+    int *index;
+    int size;               // a power of two
+    int count;
+    struct _Buffer values;  // the encoded Value messages
+};
+
+
+/* appends bytes to a buffer */
+static void put_bytes(struct _Buffer *b, char *data, int len)
+{
+    buffer_sink(b, data, len);
+}
+
+
+static void put_varint(struct _Buffer *b, unsigned int value)
+{
+    char data[8];
+    int n = 0;
+
+    while (value >= 0x80)
+    {
+        data[n++] = (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    data[n++] = (char)value;
+
+    put_bytes(b, data, n);
+}
+
+
+static void put_key(struct _Buffer *b, int field, int wire_type)
+{
+    put_varint(b, (field << 3) | wire_type);
+}
+
+
+/* appends a length delimited field: a string, packed list or message */
+static void put_message(struct _Buffer *b, int field, char *data, int len)
+{
+    put_key(b, field, WIRE_BYTES);
+    put_varint(b, len);
+    put_bytes(b, data, len);
+}
+
+
+static unsigned int zigzag(int n)
+{
+    return ((unsigned int)n << 1) ^ (unsigned int)(n >> 31);
+}
+
+
+/* returns the index of a tag value, adding it to the table if it is new */
+static int get_value_index(struct _ValueTable *t, int value)
+{
+    struct _Buffer msg;
+    int h;
+
+    h = ((unsigned int)value * 0x9E3779B1u) & (t->size - 1);
+    while (t->key[h] != -1)
+    {
+        if (t->key[h] == value)
+            return t->index[h];
+        h = (h + 1) & (t->size - 1);
+    }
+
+    t->key[h] = value;
+    t->index[h] = t->count++;
+
+    // Value { uint_value = 5 }
+    memset(&msg, 0, sizeof(struct _Buffer));
+    put_key(&msg, 5, WIRE_VARINT);
+    put_varint(&msg, value);
+    put_message(&t->values, 4, msg.data, msg.size);
+    free(msg.data);
+
+    return t->index[h];
+}
+
+
+/* 
+* Clips the line from (x1,y1) to (x2,y2) to the square from lo to hi on 
+* both axes (Liang-Barsky).  Returns 0 if nothing of it is left.
+*/
+static int clip_line(double *x1, double *y1, double *x2, double *y2, 
+                     double lo, double hi)
+{
+    double t0 = 0.0, t1 = 1.0, t;
+    double dx = *x2 - *x1, dy = *y2 - *y1;
+    double p[4], q[4];
+    int k;
+
+    p[0] = -dx;  q[0] = *x1 - lo;
+    p[1] = dx;   q[1] = hi - *x1;
+    p[2] = -dy;  q[2] = *y1 - lo;
+    p[3] = dy;   q[3] = hi - *y1;
+
+    for (k = 0; k < 4; k++)
+    {
+        if (p[k] == 0.0)
+        {
+            if (q[k] < 0.0)
+                return 0;
+            continue;
+        }
+
+        t = q[k] / p[k];
+        if (p[k] < 0.0 && t > t0)
+            t0 = t;
+        else if (p[k] > 0.0 && t < t1)
+            t1 = t;
+    }
+
+    if (t0 > t1)
+        return 0;
+
+    *x2 = *x1 + t1 * dx;
+    *y2 = *y1 + t1 * dy;
+    *x1 = *x1 + t0 * dx;
+    *y1 = *y1 + t0 * dy;
+
+    return 1;
+}
+
+
+// state of the geometry of one feature while it is being encoded
+struct _Geometry
+{
+    struct _Buffer *commands;   // the packed command integers
+    int *part;                  // points of the current part, x and y pairs
+    int num_points;
+    int cursor_x, cursor_y;     // position after the last command
+};
+
+
+/* encodes the current part as a MoveTo and a LineTo command and starts over */
+static void end_part(struct _Geometry *g)
+{
+    int j;
+
+    if (g->num_points >= 2)
+    {
+        for (j = 0; j < g->num_points; j++)
+        {
+            if (j == 0)
+                put_varint(g->commands, CMD_MOVE_TO | (1 << 3));
+            else if (j == 1)
+                put_varint(g->commands, CMD_LINE_TO | ((g->num_points - 1) << 3));
+
+            put_varint(g->commands, zigzag(g->part[2*j] - g->cursor_x));
+            put_varint(g->commands, zigzag(g->part[2*j+1] - g->cursor_y));
+            g->cursor_x = g->part[2*j];
+            g->cursor_y = g->part[2*j+1];
+        }
+    }
+
+    g->num_points = 0;
+}
+
+
+/* adds a point to the current part unless it repeats the last one */
+static void add_point(struct _Geometry *g, double x, double y)
+{
+    int ix, iy, n = g->num_points;
+
+    ix = (int)floor(x + 0.5);
+    iy = (int)floor(y + 0.5);
+    if (n > 0 && g->part[2*n-2] == ix && g->part[2*n-1] == iy)
+        return;
+
+    g->part[2*n] = ix;
+    g->part[2*n+1] = iy;
+    g->num_points++;
+}
+
+
+/* 
+* Projects segment i into tile units and adds the pieces of it that fall 
+* within the tile to the geometry.  The first piece continues the current 
+* part if that ends where the segment starts; the last piece is left open 
+* for the next segment.  A segment leaving the tile and coming back becomes 
+* several parts (a MultiLineString).
+*/
+static void encode_segment(int i, int detail, int zoom, double left, 
+                           double top, struct _Geometry *g)
+{
+    struct _Coordinates *point = NULL;
+    double x1, y1, x2, y2, px, py, cx1, cy1, cx2, cy2;
+    int j, num_points = 0, shapeIndex, inside;
+
+    shapeIndex = segment_shape[i];
+    if (shapeIndex >= 0)
+    {
+        num_points = CHAIN_LENGTH(shape_level[detail], shapeIndex);
+        point = CHAIN_POINTS(shape_level[detail], shapeIndex);
+    }
+
+    x1 = mercator_x(segment_start[i].Longitude, zoom) * (1 << UNITS_SHIFT) - left;
+    y1 = mercator_y(segment_start[i].Latitude, zoom) * (1 << UNITS_SHIFT) - top;
+    inside = (g->num_points > 0 && 
+              g->part[2*g->num_points-2] == (int)floor(x1 + 0.5) && 
+              g->part[2*g->num_points-1] == (int)floor(y1 + 0.5));
+
+    for (j = 0; j <= num_points; j++)
+    {
+        if (j < num_points)
+        {
+            px = mercator_x(point[j].Longitude, zoom);
+            py = mercator_y(point[j].Latitude, zoom);
+        }
+        else
+        {
+            px = mercator_x(segment_end[i].Longitude, zoom);
+            py = mercator_y(segment_end[i].Latitude, zoom);
+        }
+        x2 = px * (1 << UNITS_SHIFT) - left;
+        y2 = py * (1 << UNITS_SHIFT) - top;
+
+        cx1 = x1;  cy1 = y1;  cx2 = x2;  cy2 = y2;
+        if (clip_line(&cx1, &cy1, &cx2, &cy2, -BUFFER_UNITS, EXTENT + BUFFER_UNITS))
+        {
+            // the line was cut at its start, so a new part begins
+            if (!inside || cx1 != x1 || cy1 != y1)
+            {
+                end_part(g);
+                add_point(g, cx1, cy1);
+            }
+            add_point(g, cx2, cy2);
+            inside = (cx2 == x2 && cy2 == y2);
+        }
+        else
+            inside = 0;
+
+        x1 = x2;
+        y1 = y2;
+    }
+}
+
+
+/* orders segments by drawing group, street, road class and index */
+static int compare_segments(const void *a, const void *b)
+{
+    int i = *(const int *)a, j = *(const int *)b;
+
+    if (get_road_group(segment_class[i]) != get_road_group(segment_class[j]))
+        return get_road_group(segment_class[i]) - get_road_group(segment_class[j]);
+    if (segment_street[i] != segment_street[j])
+        return segment_street[i] - segment_street[j];
+    if (segment_class[i] != segment_class[j])
+        return segment_class[i] - segment_class[j];
+
+    return i - j;
+}
+
+
+/* true if segments i and j go into the same feature */
+static int same_feature(int i, int j)
+{
+    return segment_street[i] == segment_street[j] && 
+           segment_class[i] == segment_class[j];
+}
+
+
+/**
+* Encodes the vector tile zoom/x/y into a buffer, which the caller frees.  
+* A tile without any roads is an empty message.
+*
+* Returns 0 on success.
+*/
+int encode_vector_tile(int zoom, int x, int y, struct _Buffer *buffer)
+{
+    struct _MapView view;
+    struct _BoundingBox box;
+    struct _LineStyle style;
+    struct _ValueTable values;
+    struct _Buffer features, feature, tags, commands, layer;
+    struct _Geometry g;
+    double left, top;
+    int *visible, count, n, j, k, i, max_points, detail;
+
+    memset(buffer, 0, sizeof(struct _Buffer));
+
+    // the tile with a margin, for finding the segments
+    get_tile_view(&view, zoom, x, y, 1);
+    view.band_top = -(BUFFER_UNITS >> UNITS_SHIFT);
+    view.band_height = view.height + 2 * (BUFFER_UNITS >> UNITS_SHIFT);
+    get_map_bounds(&view, &box);
+    use_regions(&box);
+
+    // simplified no further than half a unit of the tile
+    detail = get_detail_level(view.scale >> UNITS_SHIFT);
+    left = (double)x * (TILE_SIZE << UNITS_SHIFT);
+    top = (double)y * (TILE_SIZE << UNITS_SHIFT);
+
+    count = grid_query(&segment_grid, &box, segment_box, &visible);
+
+    values.size = 64;
+    while (values.size < 4 * count)
+        values.size *= 2;
+    values.key = (int *)malloc(values.size * sizeof(int));
+    values.index = (int *)malloc(values.size * sizeof(int));
+    for (j = 0; j < values.size; j++)
+        values.key[j] = -1;
+    values.count = 0;
+
+    memset(&values.values, 0, sizeof(struct _Buffer));
+    memset(&features, 0, sizeof(struct _Buffer));
+    memset(&feature, 0, sizeof(struct _Buffer));
+    memset(&tags, 0, sizeof(struct _Buffer));
+    memset(&commands, 0, sizeof(struct _Buffer));
+
+    // the same roads as the image tiles show at this zoom, drawn in the 
+    // same order
+    n = 0;
+    max_points = 0;
+    for (j = 0; j < count; j++)
+    {
+        if (!get_line_style(segment_class[visible[j]], view.scale, &style))
+            continue;
+
+        visible[n++] = visible[j];
+        max_points += get_segment_points(visible[j], detail);
+    }
+    qsort(visible, n, sizeof(int), compare_segments);
+
+    g.commands = &commands;
+    g.part = (int *)malloc(2 * max_points * sizeof(int));
+
+    for (j = 0; j < n; j = k)
+    {
+        i = visible[j];
+
+        // the cursor starts over at (0,0) for each feature
+        commands.size = 0;
+        g.cursor_x = g.cursor_y = 0;
+        g.num_points = 0;
+        for (k = j; k < n && same_feature(i, visible[k]); k++)
+            encode_segment(visible[k], detail, zoom, left, top, &g);
+        end_part(&g);
+        if (commands.size == 0)
+            continue;
+
+        // both keys draw on the same table of values
+        tags.size = 0;
+        put_varint(&tags, KEY_CLASS);
+        put_varint(&tags, get_value_index(&values, segment_class[i]));
+        if (segment_street[i] >= 0)
+        {
+            put_varint(&tags, KEY_STREET);
+            put_varint(&tags, get_value_index(&values, segment_street[i]));
+        }
+
+        // Feature { tags = 2, type = 3 (LINESTRING), geometry = 4 }
+        feature.size = 0;
+        put_message(&feature, 2, tags.data, tags.size);
+        put_key(&feature, 3, WIRE_VARINT);
+        put_varint(&feature, 2);
+        put_message(&feature, 4, commands.data, commands.size);
+
+        put_message(&features, 2, feature.data, feature.size);
+    }
+
+    if (features.size > 0)
+    {
+        // Layer { name = 1, features = 2, keys = 3, values = 4, extent = 5, 
+        //         version = 15 }
+        memset(&layer, 0, sizeof(struct _Buffer));
+        put_key(&layer, 15, WIRE_VARINT);
+        put_varint(&layer, 2);
+        put_message(&layer, 1, "roads", 5);
+        put_bytes(&layer, features.data, features.size);
+        put_message(&layer, 3, tag_key[KEY_CLASS], strlen(tag_key[KEY_CLASS]));
+        put_message(&layer, 3, tag_key[KEY_STREET], strlen(tag_key[KEY_STREET]));
+        put_bytes(&layer, values.values.data, values.values.size);
+        put_key(&layer, 5, WIRE_VARINT);
+        put_varint(&layer, EXTENT);
+
+        // Tile { layers = 3 }
+        put_message(buffer, 3, layer.data, layer.size);
+        free(layer.data);
+    }
+
+    free(g.part);
+    free(visible);
+    free(values.key);
+    free(values.index);
+    free(values.values.data);
+    free(features.data);
+    free(feature.data);
+    free(tags.data);
+    free(commands.data);
+
+    return 0;
+}
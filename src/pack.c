@@ -0,0 +1,745 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+
+/*
+* Datasets packed into a single file that is mapped into memory instead of 
+* being read record by record.  Starting up then costs next to nothing, all 
+* processes serving the same data share its pages and only the parts of the 
+* data that are actually used take up memory in a process.
+*
+* A pack is written with -P from the separate data files.  It starts with a 
+* struct _PackHeader holding the record counts and where each section lies 
+* (see PACK_xxx in tmrs.h).  Segments are stored one field per section and 
+* in drawing groups, as group_segments() leaves them, and the bounding boxes 
+* of the spatial index are stored as well, so none of the data has to be 
+* looked at when loading.
+*
+* The header also records the byte order the pack was written with and a 
+* CRC-32C of itself and of every section.  All of them are checked before a 
+* pack is used, so a truncated, damaged or foreign pack is turned down 
+* instead of being drawn from.  Checking reads the whole file once, which the 
+* CRC instructions of the processor keep about as fast as the disk (see 
+* crc.c).  The file is read rather than the mapping, so checking does not 
+* pull all of the pages into the process.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "tmrs.h"
+
+
+#define CHECK_BUFFER_SIZE   (1 << 20)   // bytes read at a time to verify a pack
+
+static char *pack_data = NULL;      // the mapped file, NULL if none
+static size_t pack_size = 0;
+static int verify_sections = 0;     // check every section when loading
+
+
+/**
+* Makes load_pack() check the bytes of every section against its checksum, 
+* which reads the whole pack.  Otherwise only the header, which holds the 
+* checksums and the table of sections, is checked and the data is read as 
+* it is used.
+*/
+void set_pack_verification(int on)
+{
+    verify_sections = on;
+}
+
+
+/* returns 1 if the section lies within the file and has the given size */
+static int check_section(struct _PackSection *s, long long size)
+{
+    long long end = pack_size;
+
+    return (s->offset >= (long long)sizeof(struct _PackHeader) && 
+            s->size == size && s->offset <= end && s->size <= end - s->offset);
+}
+
+
+/* returns 1 if the header matches its checksum */
+static int check_header(struct _PackHeader *h)
+{
+    struct _PackHeader copy;
+
+    memcpy(&copy, h, sizeof(copy));
+    copy.header_crc = 0;
+
+    return (crc32c(0, &copy, sizeof(copy)) == h->header_crc);
+}
+
+
+/* 
+* returns 1 if every section of the pack open as fd matches its checksum.  
+* Sections stored once for several detail levels are only checked once.
+*/
+static int check_checksums(int fd, struct _PackHeader *h)
+{
+    struct _PackSection *s;
+    unsigned int crc;
+    long long done;
+    char *buffer;
+    int i, j, n, valid;
+
+    buffer = (char *)malloc(CHECK_BUFFER_SIZE);
+    valid = 1;
+
+    for (i = 0; valid && i < NUM_PACK_SECTIONS; i++)
+    {
+        s = &h->section[i];
+        for (j = 0; j < i; j++)
+            if (h->section[j].offset == s->offset && h->section[j].size == s->size)
+                break;
+        if (j < i)
+            continue;
+
+        crc = 0;
+        for (done = 0; done < s->size; done += n)
+        {
+            n = (s->size - done < CHECK_BUFFER_SIZE) ? s->size - done : CHECK_BUFFER_SIZE;
+            n = pread(fd, buffer, n, s->offset + done);
+            if (n <= 0)
+                break;
+            crc = crc32c(crc, buffer, n);
+        }
+
+        valid = (done == s->size && crc == s->crc);
+    }
+
+    free(buffer);
+
+    return valid;
+}
+
+
+/* returns 1 if the drawing groups of the header divide up the segments */
+static int check_groups(struct _PackHeader *h)
+{
+    int group;
+
+    if (h->group_start[0] != 0 || h->group_start[NUM_GROUPS] != h->num_segments)
+        return 0;
+
+    for (group = 0; group < NUM_GROUPS; group++)
+        if (h->group_start[group+1] < h->group_start[group])
+            return 0;
+
+    return 1;
+}
+
+
+/* returns 1 if the regions of the header lie within its data */
+static int check_regions(struct _PackHeader *h, struct _Region *r)
+{
+    int i, group;
+
+    for (i = 0; i < h->num_regions; i++)
+    {
+        for (group = 0; group < NUM_GROUPS; group++)
+            if (r[i].first_segment[group] < h->group_start[group] || 
+                r[i].num_segments[group] < 0 ||
+                r[i].num_segments[group] > h->group_start[group+1] - r[i].first_segment[group])
+                return 0;
+
+        if (r[i].first_street < 0 || r[i].num_streets < 0 || 
+            r[i].num_streets > h->num_streets - r[i].first_street ||
+            r[i].first_shape < 0 || r[i].num_shapes < 0 || 
+            r[i].num_shapes > h->num_shapes - r[i].first_shape ||
+            r[i].first_polygon < 0 || r[i].num_polygons < 0 || 
+            r[i].num_polygons > h->num_polygons - r[i].first_polygon)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+/* 
+* sets up the chains of one detail level, which are used where they lie in 
+* the pack.  Returns NULL if the index does not fit the points.
+*/
+static struct _Chains *map_chains(struct _PackHeader *h, int level)
+{
+    struct _PackSection *index_section, *point_section;
+    struct _Chains *chains;
+    int *first, num_points, i;
+
+    index_section = &h->section[PACK_CHAINS(level)];
+    point_section = &h->section[PACK_CHAIN_POINTS(level)];
+    num_points = point_section->size / sizeof(struct _Coordinates);
+
+    if (!check_section(index_section, (h->num_shapes + 1) * sizeof(int)) ||
+        !check_section(point_section, num_points * sizeof(struct _Coordinates)))
+        return NULL;
+
+    first = (int *)(pack_data + index_section->offset);
+    if (first[0] != 0 || first[h->num_shapes] != num_points)
+        return NULL;
+
+    for (i = 0; i < h->num_shapes; i++)
+        if (first[i+1] < first[i])
+            return NULL;
+
+    chains = (struct _Chains *)malloc(sizeof(struct _Chains));
+    chains->count = h->num_shapes;
+    chains->first = first;
+    chains->point = (struct _Coordinates *)(pack_data + point_section->offset);
+
+    return chains;
+}
+
+
+/* same as map_chains() for the polygons of one detail level */
+static struct _Polygon *map_polygons(struct _PackHeader *h, int level)
+{
+    struct _PackSection *index_section, *point_section;
+    struct _PackedPolygon *packed;
+    struct _Polygon *polygons;
+    struct _Coordinates *point;
+    int num_points, i;
+
+    index_section = &h->section[PACK_POLYGONS(level)];
+    point_section = &h->section[PACK_POLYGON_POINTS(level)];
+    num_points = point_section->size / sizeof(struct _Coordinates);
+
+    if (!check_section(index_section, h->num_polygons * sizeof(struct _PackedPolygon)) ||
+        !check_section(point_section, num_points * sizeof(struct _Coordinates)))
+        return NULL;
+
+    packed = (struct _PackedPolygon *)(pack_data + index_section->offset);
+    point = (struct _Coordinates *)(pack_data + point_section->offset);
+
+    polygons = (struct _Polygon *)malloc((h->num_polygons + 1) * sizeof(struct _Polygon));
+    for (i = 0; i < h->num_polygons; i++)
+    {
+        if (packed[i].first_point < 0 || packed[i].num_points < 0 ||
+            packed[i].num_points > num_points - packed[i].first_point)
+        {
+            free(polygons);
+            return NULL;
+        }
+
+        polygons[i].type = packed[i].type;
+        memcpy(polygons[i].name, packed[i].name, sizeof(polygons[i].name));
+        polygons[i].num_points = packed[i].num_points;
+        polygons[i].point = &point[packed[i].first_point];
+    }
+
+    return polygons;
+}
+
+
+/* frees the chains and polygons of the detail levels, some of which are shared */
+static void free_levels()
+{
+    int level;
+
+    for (level = NUM_DETAIL_LEVELS - 1; level >= 0; level--)
+    {
+        if (level == 0 || shape_level[level] != shape_level[level-1])
+            free(shape_level[level]);
+        if (level == 0 || polygon_level[level] != polygon_level[level-1])
+            free(polygon_level[level]);
+        shape_level[level] = NULL;
+        polygon_level[level] = NULL;
+    }
+}
+
+
+/**
+* Maps a pack into memory and makes it the dataset being served.  
+*
+* Returns 0 if it was loaded, -1 if there is no pack or it is not valid, in 
+* which case the separate data files are to be used.
+*/
+int load_pack(char *filename)
+{
+    struct _PackHeader *h;
+    struct stat st;
+    int fd, level, valid;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(struct _PackHeader))
+    {
+        fprintf(stderr, "%s is not a dataset pack, ignored\n", filename);
+        close(fd);
+        return -1;
+    }
+
+    pack_size = st.st_size;
+    pack_data = (char *)mmap(NULL, pack_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (pack_data == MAP_FAILED)
+    {
+        perror(filename);
+        close(fd);
+        pack_data = NULL;
+        return -1;
+    }
+
+    h = (struct _PackHeader *)pack_data;
+    if (!memcmp(h->magic, PACK_MAGIC, sizeof(h->magic)) && 
+        h->byte_order == PACK_SWAPPED_BYTE_ORDER)
+    {
+        fprintf(stderr, "%s was written on a machine of the other byte order, "
+            "ignored\n", filename);
+        close(fd);
+        unload_pack();
+        return -1;
+    }
+
+    valid = (!memcmp(h->magic, PACK_MAGIC, sizeof(h->magic)) && 
+        h->byte_order == PACK_BYTE_ORDER && h->version == PACK_VERSION && 
+        check_header(h) && h->num_segments >= 0 && 
+        h->num_streets >= 0 && h->num_shapes >= 0 && h->num_polygons >= 0 &&
+        h->num_regions >= 0 && check_groups(h) &&
+        check_section(&h->section[PACK_SEGMENT_CLASSES], 
+            h->num_segments * (long long)sizeof(char)) &&
+        check_section(&h->section[PACK_SEGMENT_STREETS], 
+            h->num_segments * (long long)sizeof(int)) &&
+        check_section(&h->section[PACK_SEGMENT_SHAPES], 
+            h->num_segments * (long long)sizeof(int)) &&
+        check_section(&h->section[PACK_SEGMENT_STARTS], 
+            h->num_segments * (long long)sizeof(struct _Coordinates)) &&
+        check_section(&h->section[PACK_SEGMENT_ENDS], 
+            h->num_segments * (long long)sizeof(struct _Coordinates)) &&
+        check_section(&h->section[PACK_SEGMENT_ADDRESSES], 
+            h->num_segments * (long long)sizeof(struct _AddressRange)) &&
+        check_section(&h->section[PACK_NAMES], 
+            h->num_streets * (long long)sizeof(struct _StreetName)) &&
+        check_section(&h->section[PACK_SEGMENT_BOXES], 
+            h->num_segments * (long long)sizeof(struct _BoundingBox)) &&
+        check_section(&h->section[PACK_POLYGON_BOXES], 
+            h->num_polygons * (long long)sizeof(struct _BoundingBox)) &&
+        check_section(&h->section[PACK_REGIONS], 
+            h->num_regions * (long long)sizeof(struct _Region)) &&
+        check_regions(h, (struct _Region *)(pack_data + h->section[PACK_REGIONS].offset)) &&
+        (!verify_sections || check_checksums(fd, h)));
+    close(fd);
+
+    // levels stored only once are shared, as by load_detail_levels()
+    for (level = 0; valid && level < NUM_DETAIL_LEVELS; level++)
+    {
+        if (level > 0 && h->section[PACK_CHAINS(level)].offset == 
+                         h->section[PACK_CHAINS(level-1)].offset)
+            shape_level[level] = shape_level[level-1];
+        else
+            shape_level[level] = map_chains(h, level);
+
+        if (level > 0 && h->section[PACK_POLYGONS(level)].offset == 
+                         h->section[PACK_POLYGONS(level-1)].offset)
+            polygon_level[level] = polygon_level[level-1];
+        else
+            polygon_level[level] = map_polygons(h, level);
+
+        valid = (shape_level[level] != NULL && polygon_level[level] != NULL);
+    }
+
+    if (!valid)
+    {
+        fprintf(stderr, "%s is damaged or was written by another version, "
+            "ignored\n", filename);
+        unload_pack();
+        return -1;
+    }
+
+    numRecs = h->num_segments;
+    numStreets = h->num_streets;
+    numShapes = h->num_shapes;
+    numPolygons = h->num_polygons;
+    numRegions = h->num_regions;
+    memcpy(group_start, h->group_start, sizeof(group_start));
+
+    segment_class = pack_data + h->section[PACK_SEGMENT_CLASSES].offset;
+    segment_street = (int *)(pack_data + h->section[PACK_SEGMENT_STREETS].offset);
+    segment_shape = (int *)(pack_data + h->section[PACK_SEGMENT_SHAPES].offset);
+    segment_start = (struct _Coordinates *)(pack_data + 
+        h->section[PACK_SEGMENT_STARTS].offset);
+    segment_end = (struct _Coordinates *)(pack_data + 
+        h->section[PACK_SEGMENT_ENDS].offset);
+    segment_address = (struct _AddressRange *)(pack_data + 
+        h->section[PACK_SEGMENT_ADDRESSES].offset);
+    street = (struct _StreetName *)(pack_data + h->section[PACK_NAMES].offset);
+    segment_box = (struct _BoundingBox *)(pack_data + 
+        h->section[PACK_SEGMENT_BOXES].offset);
+    polygon_box = (struct _BoundingBox *)(pack_data + 
+        h->section[PACK_POLYGON_BOXES].offset);
+    region = (numRegions > 0) ? 
+        (struct _Region *)(pack_data + h->section[PACK_REGIONS].offset) : NULL;
+    shape = shape_level[0];
+    polygon = polygon_level[0];
+
+    return 0;
+}
+
+
+/**
+* Releases a pack loaded by load_pack().
+*/
+void unload_pack()
+{
+    if (pack_data == NULL)
+        return;
+
+    free_levels();
+    munmap(pack_data, pack_size);
+    pack_data = NULL;
+    pack_size = 0;
+}
+
+
+/**
+* Returns 1 if the memory belongs to the loaded pack (and must not be freed).
+*/
+int in_pack(void *p)
+{
+    return (pack_data != NULL && (char *)p >= pack_data && 
+            (char *)p < pack_data + pack_size);
+}
+
+
+/**
+* Returns 1 if the dataset being served was mapped from a pack.
+*/
+int pack_mapped()
+{
+    return (pack_data != NULL);
+}
+
+
+/**
+* Returns the header checksum of the pack being served, which changes 
+* whenever anything in the pack does, or 0 if the data was not mapped from 
+* a pack.
+*/
+unsigned int pack_id()
+{
+    if (pack_data == NULL)
+        return 0;
+
+    return ((struct _PackHeader *)pack_data)->header_crc;
+}
+
+
+// everything that makes up the dataset being served, see reload_pack()
+struct _Dataset
+{
+    char *pack_data;
+    size_t pack_size;
+    char *segment_class;
+    int *segment_street, *segment_shape;
+    struct _Coordinates *segment_start, *segment_end;
+    struct _AddressRange *segment_address;
+    struct _StreetName *street;
+    struct _Chains *shape_level[NUM_DETAIL_LEVELS];
+    struct _Polygon *polygon_level[NUM_DETAIL_LEVELS];
+    int numRecs, numStreets, numShapes, numPolygons;
+    int group_start[NUM_GROUPS+1];
+    struct _Region *region;
+    int numRegions;
+    struct _BoundingBox *segment_box, *polygon_box, dataset_bounds;
+    struct _Grid segment_grid, polygon_grid;
+};
+
+
+/* copies the global variables of the dataset being served into d */
+static void save_dataset(struct _Dataset *d)
+{
+    d->pack_data = pack_data;
+    d->pack_size = pack_size;
+    d->segment_class = segment_class;
+    d->segment_street = segment_street;
+    d->segment_shape = segment_shape;
+    d->segment_start = segment_start;
+    d->segment_end = segment_end;
+    d->segment_address = segment_address;
+    d->street = street;
+    memcpy(d->shape_level, shape_level, sizeof(shape_level));
+    memcpy(d->polygon_level, polygon_level, sizeof(polygon_level));
+    d->numRecs = numRecs;
+    d->numStreets = numStreets;
+    d->numShapes = numShapes;
+    d->numPolygons = numPolygons;
+    memcpy(d->group_start, group_start, sizeof(group_start));
+    d->region = region;
+    d->numRegions = numRegions;
+    d->segment_box = segment_box;
+    d->polygon_box = polygon_box;
+    d->dataset_bounds = dataset_bounds;
+    d->segment_grid = segment_grid;
+    d->polygon_grid = polygon_grid;
+}
+
+
+/* makes the dataset saved in d the one being served */
+static void use_dataset(struct _Dataset *d)
+{
+    pack_data = d->pack_data;
+    pack_size = d->pack_size;
+    segment_class = d->segment_class;
+    segment_street = d->segment_street;
+    segment_shape = d->segment_shape;
+    segment_start = d->segment_start;
+    segment_end = d->segment_end;
+    segment_address = d->segment_address;
+    street = d->street;
+    memcpy(shape_level, d->shape_level, sizeof(shape_level));
+    memcpy(polygon_level, d->polygon_level, sizeof(polygon_level));
+    shape = shape_level[0];
+    polygon = polygon_level[0];
+    numRecs = d->numRecs;
+    numStreets = d->numStreets;
+    numShapes = d->numShapes;
+    numPolygons = d->numPolygons;
+    memcpy(group_start, d->group_start, sizeof(group_start));
+    region = d->region;
+    numRegions = d->numRegions;
+    segment_box = d->segment_box;
+    polygon_box = d->polygon_box;
+    dataset_bounds = d->dataset_bounds;
+    segment_grid = d->segment_grid;
+    polygon_grid = d->polygon_grid;
+}
+
+
+/**
+* Replaces the dataset being served with the pack in the given file, normally 
+* a newer one written with -P while the server kept running.  The new pack 
+* is mapped, checked and indexed before the old dataset is let go, so if it 
+* is not valid nothing changes.  Must be called between requests.
+*
+* Returns 0 if the new dataset is now served, -1 if the old one still is.
+*/
+int reload_pack(char *filename)
+{
+    struct _Dataset old, new;
+
+    save_dataset(&old);
+
+    pack_data = NULL;
+    pack_size = 0;
+    memset(shape_level, 0, sizeof(shape_level));
+    memset(polygon_level, 0, sizeof(polygon_level));
+
+    if (load_pack(filename) != 0)
+    {
+        fprintf(stderr, "%s could not be loaded, keeping the data in use\n", 
+            filename);
+        use_dataset(&old);
+        return -1;
+    }
+
+    build_spatial_index();
+    save_dataset(&new);
+
+    use_dataset(&old);
+    unload_dataset();
+    use_dataset(&new);
+    init_regions();
+
+    // tiles drawn from the old data must not be served any more
+    drop_metatile();
+    tile_cache_clear();
+
+    return 0;
+}
+
+
+/* pads the file up to the next section and notes where the section starts */
+static void begin_section(FILE *fp, struct _PackSection *s)
+{
+    while (ftell(fp) % PACK_ALIGN)
+        fputc(0, fp);
+
+    s->offset = ftell(fp);
+    s->crc = 0;
+}
+
+
+static void end_section(FILE *fp, struct _PackSection *s)
+{
+    s->size = ftell(fp) - s->offset;
+}
+
+
+/* writes data into the section begun last, adding it to its checksum */
+static void write_data(FILE *fp, struct _PackSection *s, void *data, long size)
+{
+    fwrite(data, 1, size, fp);
+    s->crc = crc32c(s->crc, data, size);
+}
+
+
+/* writes an array as a section of its own */
+static void write_section(FILE *fp, struct _PackSection *s, void *data, int size)
+{
+    begin_section(fp, s);
+    write_data(fp, s, data, size);
+    end_section(fp, s);
+}
+
+
+/* writes the index and points of the chains of one detail level */
+static void write_chains(FILE *fp, struct _PackHeader *h, struct _Chains *chains, 
+                         int level)
+{
+    write_section(fp, &h->section[PACK_CHAINS(level)], chains->first, 
+        (chains->count + 1) * sizeof(int));
+    write_section(fp, &h->section[PACK_CHAIN_POINTS(level)], chains->point, 
+        chains->first[chains->count] * sizeof(struct _Coordinates));
+}
+
+
+/* writes the index and points of the polygons of one detail level */
+static void write_polygons(FILE *fp, struct _PackHeader *h, struct _Polygon *polygons, 
+                           int level)
+{
+    struct _PackedPolygon *packed;
+    int i, first;
+
+    packed = (struct _PackedPolygon *)calloc(numPolygons + 1, sizeof(struct _PackedPolygon));
+    first = 0;
+    for (i = 0; i < numPolygons; i++)
+    {
+        packed[i].type = polygons[i].type;
+        memcpy(packed[i].name, polygons[i].name, sizeof(packed[i].name));
+        packed[i].first_point = first;
+        packed[i].num_points = polygons[i].num_points;
+        first += polygons[i].num_points;
+    }
+
+    write_section(fp, &h->section[PACK_POLYGONS(level)], packed, 
+        numPolygons * sizeof(struct _PackedPolygon));
+    free(packed);
+
+    begin_section(fp, &h->section[PACK_POLYGON_POINTS(level)]);
+    for (i = 0; i < numPolygons; i++)
+        write_data(fp, &h->section[PACK_POLYGON_POINTS(level)], polygons[i].point, 
+            polygons[i].num_points * sizeof(struct _Coordinates));
+    end_section(fp, &h->section[PACK_POLYGON_POINTS(level)]);
+}
+
+
+/**
+* Writes the dataset that is loaded, with its spatial index built, into a 
+* pack.  The pack is written to a temporary file first and renamed, so a 
+* server starting meanwhile never maps half a pack.
+*
+* Returns 0 on success, -1 if the file could not be written.
+*/
+int write_pack(char *filename)
+{
+    struct _PackHeader h;
+    char temp[300];
+    int level, result;
+    FILE *fp;
+
+    sprintf(temp, "%s.%d", filename, (int)getpid());
+    fp = fopen(temp, "wb");
+    if (fp == NULL)
+    {
+        perror(temp);
+        return -1;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PACK_MAGIC, sizeof(h.magic));
+    h.byte_order = PACK_BYTE_ORDER;
+    h.version = PACK_VERSION;
+    h.num_segments = numRecs;
+    h.num_streets = numStreets;
+    h.num_shapes = numShapes;
+    h.num_polygons = numPolygons;
+    h.num_regions = numRegions;
+    memcpy(h.group_start, group_start, sizeof(h.group_start));
+
+    // the header is written again at the end, once the sections are known
+    fwrite(&h, sizeof(h), 1, fp);
+    write_section(fp, &h.section[PACK_SEGMENT_CLASSES], segment_class, 
+        numRecs * sizeof(char));
+    write_section(fp, &h.section[PACK_SEGMENT_STREETS], segment_street, 
+        numRecs * sizeof(int));
+    write_section(fp, &h.section[PACK_SEGMENT_SHAPES], segment_shape, 
+        numRecs * sizeof(int));
+    write_section(fp, &h.section[PACK_SEGMENT_STARTS], segment_start, 
+        numRecs * sizeof(struct _Coordinates));
+    write_section(fp, &h.section[PACK_SEGMENT_ENDS], segment_end, 
+        numRecs * sizeof(struct _Coordinates));
+    write_section(fp, &h.section[PACK_SEGMENT_ADDRESSES], segment_address, 
+        numRecs * sizeof(struct _AddressRange));
+    write_section(fp, &h.section[PACK_NAMES], street, 
+        numStreets * sizeof(struct _StreetName));
+    write_section(fp, &h.section[PACK_SEGMENT_BOXES], segment_box, 
+        numRecs * sizeof(struct _BoundingBox));
+    write_section(fp, &h.section[PACK_POLYGON_BOXES], polygon_box, 
+        numPolygons * sizeof(struct _BoundingBox));
+    write_section(fp, &h.section[PACK_REGIONS], region, 
+        numRegions * sizeof(struct _Region));
+
+    // levels missing from the data directory use the level below, store 
+    // those just once
+    for (level = 0; level < NUM_DETAIL_LEVELS; level++)
+    {
+        if (level > 0 && shape_level[level] == shape_level[level-1])
+        {
+            h.section[PACK_CHAINS(level)] = h.section[PACK_CHAINS(level-1)];
+            h.section[PACK_CHAIN_POINTS(level)] = h.section[PACK_CHAIN_POINTS(level-1)];
+        }
+        else
+            write_chains(fp, &h, shape_level[level], level);
+
+        if (level > 0 && polygon_level[level] == polygon_level[level-1])
+        {
+            h.section[PACK_POLYGONS(level)] = h.section[PACK_POLYGONS(level-1)];
+            h.section[PACK_POLYGON_POINTS(level)] = 
+                h.section[PACK_POLYGON_POINTS(level-1)];
+        }
+        else
+            write_polygons(fp, &h, polygon_level[level], level);
+    }
+
+    h.header_crc = crc32c(0, &h, sizeof(h));
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&h, sizeof(h), 1, fp);
+
+    result = (ferror(fp) ? -1 : 0);
+    if (fclose(fp) != 0)
+        result = -1;
+
+    if (result == 0 && rename(temp, filename) == 0)
+        return 0;
+
+    perror(filename);
+    unlink(temp);
+
+    return -1;
+}
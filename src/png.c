@@ -0,0 +1,365 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+/*
+* PNG output written with libpng directly instead of through gd.  Maps are 
+* drawn in a handful of style colors plus the anti-aliased edges of text, 
+* so the "PNG8" format stores them as palette images: 1, 2, 4 or 8 bits per 
+* pixel instead of 24.  When an image has more than 256 colors (only ever 
+* the blended edges of labels), the rarest ones are replaced by the closest 
+* palette entry; there is no dithering.
+*
+* The zlib level and strategy used for both PNG formats are set with -z.  gd 
+* only takes a level, so true color PNGs are written here as well when a 
+* strategy is set.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <png.h>
+#include "gd.h"
+#include "tmrs.h"
+
+
+#define COLOR_HASH_SIZE     4096    // distinct colors counted, a power of two
+#define MAX_PALETTE         256
+
+// one distinct color of an image
+struct _ColorCount
+{
+    int color;                  // -1 marks an empty slot
+    int count;
+    int index;                  // palette entry the color is written as
+};
+
+static int png_level = -1;                  // zlib default
+static int png_strategy = -1;               // libpng default
+
+static char *strategy_name[] = { "default", "filtered", "huffman", "rle", "fixed" };
+
+
+/**
+* Sets the zlib compression used for PNG output from a string of the form 
+* <level>[,<strategy>], level being 0-9 and strategy one of default, 
+* filtered, huffman, rle or fixed.  NULL restores the defaults.  Returns -1 
+* if the string is not valid.
+*/
+int set_png_compression(char *str)
+{
+    char *comma;
+    int i, level;
+
+    if (str == NULL)
+    {
+        png_level = -1;
+        png_strategy = -1;
+        return 0;
+    }
+
+    level = atoi(str);
+    if (level < 0 || level > 9)
+        return -1;
+
+    png_level = level;
+    comma = strchr(str, ',');
+    if (comma == NULL)
+    {
+        png_strategy = -1;
+        return 0;
+    }
+
+    // the names are in the order of zlib's Z_DEFAULT_STRATEGY to Z_FIXED
+    for (i = 0; i < 5; i++)
+    {
+        if (strcmp(comma + 1, strategy_name[i]) == 0)
+        {
+            png_strategy = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+
+/**
+* Returns the zlib level set with set_png_compression(), or -1 for the 
+* default.
+*/
+int get_png_level()
+{
+    return png_level;
+}
+
+
+/**
+* Returns the zlib strategy set with set_png_compression(), or -1 for the 
+* default.
+*/
+int get_png_strategy()
+{
+    return png_strategy;
+}
+
+
+static unsigned int color_hash(int color)
+{
+    unsigned int h = (unsigned int)color * 0x9E3779B1u;
+
+    return (h >> 16) & (COLOR_HASH_SIZE - 1);
+}
+
+
+/* finds the slot of a color, or the empty slot where it belongs */
+static struct _ColorCount *find_color(struct _ColorCount *table, int color)
+{
+    unsigned int h = color_hash(color);
+
+    while (table[h].color != -1 && table[h].color != color)
+        h = (h + 1) & (COLOR_HASH_SIZE - 1);
+
+    return &table[h];
+}
+
+
+static int compare_counts(const void *a, const void *b)
+{
+    return (*(struct _ColorCount **)b)->count - (*(struct _ColorCount **)a)->count;
+}
+
+
+/* returns the palette entry closest to a color */
+static int nearest_color(png_color *palette, int n, int color)
+{
+    int i, best = 0, d, best_d = 0x7FFFFFFF;
+    int r = gdTrueColorGetRed(color), g = gdTrueColorGetGreen(color);
+    int b = gdTrueColorGetBlue(color);
+
+    for (i = 0; i < n; i++)
+    {
+        d = (palette[i].red - r) * (palette[i].red - r) + 
+            (palette[i].green - g) * (palette[i].green - g) + 
+            (palette[i].blue - b) * (palette[i].blue - b);
+        if (d < best_d)
+        {
+            best_d = d;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+
+/**
+* Builds the palette of an image and the palette index of every pixel.
+*
+* Returns the number of palette entries.
+*/
+static int build_palette(gdImagePtr im, png_color *palette, unsigned char *pixels)
+{
+    struct _ColorCount *table, *slot, *sorted[COLOR_HASH_SIZE];
+    int x, y, i, n, color, last_color, last_index, num_colors;
+
+    table = (struct _ColorCount *)malloc(COLOR_HASH_SIZE * sizeof(struct _ColorCount));
+    for (i = 0; i < COLOR_HASH_SIZE; i++)
+        table[i].color = -1;
+
+    // count the colors, ignoring new ones once the table is half full
+    num_colors = 0;
+    for (y = 0; y < im->sy; y++)
+    {
+        for (x = 0; x < im->sx; x++)
+        {
+            color = im->tpixels[y][x] & 0xFFFFFF;
+            slot = find_color(table, color);
+            if (slot->color == -1)
+            {
+                if (num_colors >= COLOR_HASH_SIZE / 2)
+                    continue;
+                slot->color = color;
+                slot->count = 0;
+                sorted[num_colors++] = slot;
+            }
+            ++slot->count;
+        }
+    }
+
+    // the most common colors go into the palette
+    if (num_colors > MAX_PALETTE)
+        qsort(sorted, num_colors, sizeof(struct _ColorCount *), compare_counts);
+
+    n = (num_colors > MAX_PALETTE) ? MAX_PALETTE : num_colors;
+    for (i = 0; i < n; i++)
+    {
+        palette[i].red = gdTrueColorGetRed(sorted[i]->color);
+        palette[i].green = gdTrueColorGetGreen(sorted[i]->color);
+        palette[i].blue = gdTrueColorGetBlue(sorted[i]->color);
+        sorted[i]->index = i;
+    }
+    for (i = n; i < num_colors; i++)
+        sorted[i]->index = nearest_color(palette, n, sorted[i]->color);
+
+    // look up the entry of every pixel, remembering the last one for runs
+    last_color = -1;
+    last_index = 0;
+    for (y = 0; y < im->sy; y++)
+    {
+        for (x = 0; x < im->sx; x++)
+        {
+            color = im->tpixels[y][x] & 0xFFFFFF;
+            if (color != last_color)
+            {
+                slot = find_color(table, color);
+                last_index = (slot->color == color) ? slot->index : 
+                    nearest_color(palette, n, color);
+                last_color = color;
+            }
+            *pixels++ = last_index;
+        }
+    }
+
+    free(table);
+    return n;
+}
+
+
+/* passes the encoded PNG on to the sink */
+static void png_write_sink(png_structp png, png_bytep data, png_size_t length)
+{
+    sink_write((gdSinkPtr)png_get_io_ptr(png), (char *)data, length);
+}
+
+
+static void png_flush_sink(png_structp png)
+{
+}
+
+
+/* sends the output of png to the sink, compressed as set with -z */
+static void set_png_output(png_structp png, gdSinkPtr pSink)
+{
+    png_set_write_fn(png, pSink, png_write_sink, png_flush_sink);
+    if (png_level >= 0)
+        png_set_compression_level(png, png_level);
+    if (png_strategy >= 0)
+        png_set_compression_strategy(png, png_strategy);
+}
+
+
+/**
+* Writes a true color image to the sink as a palette PNG.
+*/
+void image_png8_to_sink(gdImagePtr im, gdSinkPtr pSink)
+{
+    png_structp png;
+    png_infop info;
+    png_color palette[MAX_PALETTE];
+    unsigned char *pixels;
+    png_bytep *rows;
+    int i, n, depth;
+
+    pixels = (unsigned char *)malloc(im->sx * im->sy);
+    rows = (png_bytep *)malloc(im->sy * sizeof(png_bytep));
+    for (i = 0; i < im->sy; i++)
+        rows[i] = pixels + i * im->sx;
+
+    n = build_palette(im, palette, pixels);
+    for (depth = 1; (1 << depth) < n; depth *= 2)
+        ;
+
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info = (png != NULL) ? png_create_info_struct(png) : NULL;
+    if (info == NULL || setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        free(rows);
+        free(pixels);
+        return;
+    }
+
+    set_png_output(png, pSink);
+
+    // filtering rarely helps palette images
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+
+    png_set_IHDR(png, info, im->sx, im->sy, depth, PNG_COLOR_TYPE_PALETTE, 
+        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    png_set_PLTE(png, info, palette, n);
+    png_write_info(png, info);
+
+    // rows hold one byte per pixel, libpng packs them into depth bits
+    png_set_packing(png);
+    png_write_image(png, rows);
+    png_write_end(png, info);
+
+    png_destroy_write_struct(&png, &info);
+    free(rows);
+    free(pixels);
+}
+
+
+/**
+* Writes a true color image to the sink as an RGB PNG, as gd does.
+*/
+void image_png24_to_sink(gdImagePtr im, gdSinkPtr pSink)
+{
+    png_structp png;
+    png_infop info;
+    unsigned char *row, *p;
+    int x, y, color;
+
+    row = (unsigned char *)malloc(im->sx * 3);
+
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info = (png != NULL) ? png_create_info_struct(png) : NULL;
+    if (info == NULL || setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        free(row);
+        return;
+    }
+
+    set_png_output(png, pSink);
+    png_set_IHDR(png, info, im->sx, im->sy, 8, PNG_COLOR_TYPE_RGB, 
+        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    png_write_info(png, info);
+
+    for (y = 0; y < im->sy; y++)
+    {
+        p = row;
+        for (x = 0; x < im->sx; x++)
+        {
+            color = im->tpixels[y][x];
+            *p++ = gdTrueColorGetRed(color);
+            *p++ = gdTrueColorGetGreen(color);
+            *p++ = gdTrueColorGetBlue(color);
+        }
+        png_write_row(png, row);
+    }
+    png_write_end(png, info);
+
+    png_destroy_write_struct(&png, &info);
+    free(row);
+}
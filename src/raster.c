@@ -0,0 +1,492 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+/*
+* A scanline rasterizer used in place of libgd for the road and polygon 
+* fills (see the -b option).  Shapes are drawn straight into the true color 
+* pixel rows of a gd image, so everything else (labels, encoding, tiles) 
+* keeps working on the result.  
+*
+* Polygons are filled with the even-odd rule, sampling pixel centers.  With 
+* anti-aliasing each pixel row is sampled at RASTER_SUBSAMPLES heights and 
+* the exact horizontal coverage is accumulated; fully covered runs are still 
+* written as solid spans.  Thick lines are turned into one quad per piece 
+* plus a disc on every vertex, mirroring draw_polyline().
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "gd.h"
+#include "tmrs.h"
+
+#define RASTER_SUBSAMPLES   4       // sample rows per pixel when anti-aliasing
+#define DISC_POINTS         12      // corners of the polygon used for a disc
+
+
+struct _RasterPoint
+{
+    double x, y;
+};
+
+// polygon edge, always pointing downwards (y0 < y1)
+struct _RasterEdge
+{
+    double x0, y0, y1;
+    double dxdy;
+};
+
+struct _Raster
+{
+    gdImagePtr im;
+    int top;                    // row of the whole map drawn on the first row
+    int antialias;
+    float *coverage;            // coverage of the pixels of the current row
+    struct _RasterEdge *edge;   // scratch space, grown as needed
+    int *active;
+    double *cross;
+    struct _RasterPoint *point;
+    int allocated;
+};
+
+
+/**
+* Creates a rasterizer drawing onto a true color image.  When drawing a band 
+* of a map, top is the row of the map the image starts at.  Shapes are still 
+* rasterized in map coordinates so that bands join up exactly.
+*/
+struct _Raster *raster_create(gdImagePtr im, int top, int antialias)
+{
+    struct _Raster *r;
+
+    r = (struct _Raster *)calloc(1, sizeof(struct _Raster));
+    r->im = im;
+    r->top = top;
+    r->antialias = antialias;
+    r->coverage = (float *)calloc(im->sx + 1, sizeof(float));
+
+    return r;
+}
+
+
+void raster_destroy(struct _Raster *r)
+{
+    free(r->coverage);
+    free(r->edge);
+    free(r->active);
+    free(r->cross);
+    free(r->point);
+    free(r);
+}
+
+
+/* makes room for polygons of up to n points */
+static void raster_reserve(struct _Raster *r, int n)
+{
+    if (n <= r->allocated)
+        return;
+
+    r->allocated = n * 2;
+    r->edge = (struct _RasterEdge *)realloc(r->edge, 
+        r->allocated * sizeof(struct _RasterEdge));
+    r->active = (int *)realloc(r->active, r->allocated * sizeof(int));
+    r->cross = (double *)realloc(r->cross, r->allocated * sizeof(double));
+    r->point = (struct _RasterPoint *)realloc(r->point, 
+        r->allocated * sizeof(struct _RasterPoint));
+}
+
+
+/* sets n pixels starting at p to the same color */
+static void fill_span(int *p, int n, int color)
+{
+#ifdef __SSE2__
+    __m128i c = _mm_set1_epi32(color);
+
+    for (; n >= 4; n -= 4, p += 4)
+        _mm_storeu_si128((__m128i *)p, c);
+#endif
+    while (n-- > 0)
+        *p++ = color;
+}
+
+
+/* mixes color into a pixel, covering the given fraction of it */
+static int blend_pixel(int pixel, int color, float coverage)
+{
+    int r, g, b;
+
+    r = gdTrueColorGetRed(pixel);
+    g = gdTrueColorGetGreen(pixel);
+    b = gdTrueColorGetBlue(pixel);
+
+    r += (int)((gdTrueColorGetRed(color) - r) * coverage + 0.5f);
+    g += (int)((gdTrueColorGetGreen(color) - g) * coverage + 0.5f);
+    b += (int)((gdTrueColorGetBlue(color) - b) * coverage + 0.5f);
+
+    return gdTrueColor(r, g, b);
+}
+
+
+static int compare_edges(const void *a, const void *b)
+{
+    double d = ((struct _RasterEdge *)a)->y0 - ((struct _RasterEdge *)b)->y0;
+
+    return (d > 0) - (d < 0);
+}
+
+
+/* sorts edges by their top; most shapes are quads and discs */
+static void sort_edges(struct _RasterEdge *edge, int n)
+{
+    struct _RasterEdge t;
+    int i, j;
+
+    if (n > 16)
+    {
+        qsort(edge, n, sizeof(struct _RasterEdge), compare_edges);
+        return;
+    }
+
+    for (i = 1; i < n; i++)
+    {
+        t = edge[i];
+        for (j = i; j > 0 && edge[j-1].y0 > t.y0; j--)
+            edge[j] = edge[j-1];
+        edge[j] = t;
+    }
+}
+
+
+/* sorts the few crossings of a scanline */
+static void sort_crossings(double *x, int n)
+{
+    int i, j;
+    double t;
+
+    for (i = 1; i < n; i++)
+    {
+        t = x[i];
+        for (j = i; j > 0 && x[j-1] > t; j--)
+            x[j] = x[j-1];
+        x[j] = t;
+    }
+}
+
+
+/* finds where the active edges cross the horizontal line at y */
+static int get_crossings(struct _Raster *r, int num_active, double y)
+{
+    struct _RasterEdge *e;
+    int i, n = 0;
+
+    for (i = 0; i < num_active; i++)
+    {
+        e = &r->edge[r->active[i]];
+        if (e->y0 <= y && y < e->y1)
+            r->cross[n++] = e->x0 + (y - e->y0) * e->dxdy;
+    }
+
+    sort_crossings(r->cross, n);
+    return n;
+}
+
+
+/* adds the coverage of the span [x1,x2) in one sample row */
+static void add_coverage(float *coverage, double x1, double x2, float weight)
+{
+    int i, i1, i2;
+
+    i1 = (int)x1;
+    i2 = (int)x2;
+
+    if (i1 == i2)
+    {
+        coverage[i1] += (float)(x2 - x1) * weight;
+        return;
+    }
+
+    coverage[i1] += (float)(i1 + 1 - x1) * weight;
+    for (i = i1 + 1; i < i2; i++)
+        coverage[i] += weight;
+    coverage[i2] += (float)(x2 - i2) * weight;
+}
+
+
+/* writes the accumulated coverage of row y and clears it */
+static void flush_coverage(struct _Raster *r, int y, int x1, int x2, int color)
+{
+    int *row = r->im->tpixels[y];
+    float *coverage = r->coverage;
+    int x, start;
+
+    for (x = x1; x <= x2; x++)
+    {
+        if (coverage[x] >= 0.999f)
+        {
+            start = x;
+            while (x <= x2 && coverage[x] >= 0.999f)
+                coverage[x++] = 0.0f;
+            fill_span(&row[start], x - start, color);
+            --x;
+        }
+        else if (coverage[x] > 0.0f)
+        {
+            row[x] = blend_pixel(row[x], color, coverage[x]);
+            coverage[x] = 0.0f;
+        }
+    }
+}
+
+
+/**
+* Fills a polygon given in pixel space, where (0,0) is the top left corner 
+* of the image (and not the center of the top left pixel).
+*/
+static void fill_polygon(struct _Raster *r, struct _RasterPoint *p, int n, 
+                         int color)
+{
+    gdImagePtr im = r->im;
+    struct _RasterEdge *e;
+    int i, j, k, y, y1, y2, x1, x2, num_edges, next, num_active, num_cross;
+    int min_x, max_x;
+    double ymin, ymax, xa, xb, sy;
+    float weight;
+
+    // build the edge list, skipping horizontal edges
+    num_edges = 0;
+    ymin = ymax = p[0].y;
+    for (i = 0; i < n; i++)
+    {
+        j = (i + 1) % n;
+        if (p[i].y == p[j].y)
+            continue;
+
+        e = &r->edge[num_edges++];
+        k = (p[i].y < p[j].y) ? i : j;
+        e->x0 = p[k].x;
+        e->y0 = p[k].y;
+        e->y1 = p[i + j - k].y;
+        e->dxdy = (p[i + j - k].x - p[k].x) / (e->y1 - e->y0);
+
+        if (e->y0 < ymin) ymin = e->y0;
+        if (e->y1 > ymax) ymax = e->y1;
+    }
+
+    if (num_edges < 2)
+        return;
+
+    sort_edges(r->edge, num_edges);
+
+    y1 = (ymin < r->top) ? r->top : (int)ymin;
+    y2 = (ymax >= r->top + im->sy) ? r->top + im->sy - 1 : (int)ymax;
+    weight = 1.0f / RASTER_SUBSAMPLES;
+
+    next = 0;
+    num_active = 0;
+    for (y = y1; y <= y2; y++)
+    {
+        // drop the edges that end above this row, add those starting in it
+        for (i = 0, j = 0; i < num_active; i++)
+            if (r->edge[r->active[i]].y1 > y)
+                r->active[j++] = r->active[i];
+        num_active = j;
+
+        while (next < num_edges && r->edge[next].y0 < y + 1)
+        {
+            if (r->edge[next].y1 > y)
+                r->active[num_active++] = next;
+            ++next;
+        }
+
+        if (!r->antialias)
+        {
+            num_cross = get_crossings(r, num_active, y + 0.5);
+            for (i = 0; i + 1 < num_cross; i += 2)
+            {
+                // pixels whose center falls within the span
+                x1 = (int)ceil(r->cross[i] - 0.5);
+                x2 = (int)ceil(r->cross[i+1] - 0.5) - 1;
+                if (x1 < 0) x1 = 0;
+                if (x2 >= im->sx) x2 = im->sx - 1;
+
+                if (x2 >= x1)
+                    fill_span(&im->tpixels[y - r->top][x1], x2 - x1 + 1, color);
+            }
+            continue;
+        }
+
+        min_x = im->sx;
+        max_x = -1;
+        for (k = 0; k < RASTER_SUBSAMPLES; k++)
+        {
+            sy = y + (k + 0.5) / RASTER_SUBSAMPLES;
+            num_cross = get_crossings(r, num_active, sy);
+
+            for (i = 0; i + 1 < num_cross; i += 2)
+            {
+                xa = (r->cross[i] < 0) ? 0 : r->cross[i];
+                xb = (r->cross[i+1] > im->sx) ? im->sx : r->cross[i+1];
+                if (xb <= xa)
+                    continue;
+
+                add_coverage(r->coverage, xa, xb, weight);
+                if ((int)xa < min_x) min_x = (int)xa;
+                if ((int)xb > max_x) max_x = (int)xb;
+            }
+        }
+
+        if (max_x >= im->sx)
+            max_x = im->sx - 1;
+        if (max_x >= min_x)
+            flush_coverage(r, y - r->top, min_x, max_x, color);
+    }
+}
+
+
+/**
+* Fills a polygon given in image pixels, like gdImageFilledPolygon().
+*/
+void raster_polygon(struct _Raster *r, gdPoint *p, int n, int color)
+{
+    int i;
+
+    if (n < 3)
+        return;
+
+    raster_reserve(r, n);
+    for (i = 0; i < n; i++)
+    {
+        r->point[i].x = p[i].x + 0.5;
+        r->point[i].y = p[i].y + r->top + 0.5;
+    }
+
+    fill_polygon(r, r->point, n, color);
+}
+
+
+/* returns 1 if a box around the given pixels misses the image */
+static int outside_image(gdImagePtr im, int x1, int y1, int x2, int y2, int margin)
+{
+    return (x1 < -margin && x2 < -margin) || (y1 < -margin && y2 < -margin) ||
+           (x1 >= im->sx + margin && x2 >= im->sx + margin) || 
+           (y1 >= im->sy + margin && y2 >= im->sy + margin);
+}
+
+
+// corners of a disc of radius 1, filled in once by init_unit_disc() since 
+// the bands of a map are drawn by several threads at a time
+static struct _RasterPoint unit_disc[DISC_POINTS];
+static pthread_once_t unit_disc_once = PTHREAD_ONCE_INIT;
+
+
+static void init_unit_disc()
+{
+    int i;
+
+    for (i = 0; i < DISC_POINTS; i++)
+    {
+        unit_disc[i].x = cos(2.0 * M_PI * i / DISC_POINTS);
+        unit_disc[i].y = sin(2.0 * M_PI * i / DISC_POINTS);
+    }
+}
+
+
+/* fills a disc of the given diameter centered on a pixel */
+static void raster_disc(struct _Raster *r, gdPoint *center, int diameter, int color)
+{
+    struct _RasterPoint disc[DISC_POINTS];
+    double radius = diameter / 2.0;
+    int i;
+
+    if (outside_image(r->im, center->x, center->y, center->x, center->y, diameter))
+        return;
+
+    pthread_once(&unit_disc_once, init_unit_disc);
+
+    for (i = 0; i < DISC_POINTS; i++)
+    {
+        disc[i].x = center->x + 0.5 + radius * unit_disc[i].x;
+        disc[i].y = center->y + r->top + 0.5 + radius * unit_disc[i].y;
+    }
+
+    fill_polygon(r, disc, DISC_POINTS, color);
+}
+
+
+/**
+* Draws a thick polyline, like draw_polyline() does with libgd.  Every piece 
+* is a quad reaching half a pixel past its end points so that thin lines 
+* have no gaps at the joins; thick lines get round joins and caps.
+*/
+void raster_polyline(struct _Raster *r, gdPoint *p, int n, int width, int color)
+{
+    struct _RasterPoint quad[4];
+    double dx, dy, len, half;
+    int i;
+
+    raster_reserve(r, DISC_POINTS);
+
+    if (n == 1)
+    {
+        if (CONTAINS(0, r->im->sx - 1, p[0].x) && CONTAINS(0, r->im->sy - 1, p[0].y))
+            r->im->tpixels[p[0].y][p[0].x] = color;
+        return;
+    }
+
+    half = width / 2.0;
+    for (i = 0; i < n - 1; i++)
+    {
+        dx = p[i+1].x - p[i].x;
+        dy = p[i+1].y - p[i].y;
+        if (outside_image(r->im, p[i].x, p[i].y, p[i+1].x, p[i+1].y, width))
+            continue;
+
+        len = sqrt(dx * dx + dy * dy);
+        if (len == 0.0)
+            continue;
+
+        // unit vector along the line, scaled to half the width
+        dx = dx / len * half;
+        dy = dy / len * half;
+
+        quad[0].x = p[i].x + 0.5 - dy - dx / width;
+        quad[0].y = p[i].y + r->top + 0.5 + dx - dy / width;
+        quad[1].x = p[i+1].x + 0.5 - dy + dx / width;
+        quad[1].y = p[i+1].y + r->top + 0.5 + dx + dy / width;
+        quad[2].x = p[i+1].x + 0.5 + dy + dx / width;
+        quad[2].y = p[i+1].y + r->top + 0.5 - dx + dy / width;
+        quad[3].x = p[i].x + 0.5 + dy - dx / width;
+        quad[3].y = p[i].y + r->top + 0.5 - dx - dy / width;
+
+        fill_polygon(r, quad, 4, color);
+    }
+
+    if (width > 2)
+        for (i = 0; i < n; i++)
+            raster_disc(r, &p[i], width, color);
+}
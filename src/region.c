@@ -0,0 +1,272 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+/*
+* Datasets made up of many regions (see load_regions()) of which only a few 
+* are in use at any time.  A pack is mapped into memory, so the data of a 
+* region is only read once something in it is drawn.  Each region is stored 
+* in a few contiguous runs per section, which lets the pages of the regions 
+* that were drawn least recently be released again once the regions drawn 
+* add up to more than the number of megabytes set with -M.  Released pages 
+* are read back as soon as they are needed, so this never changes what is 
+* drawn.
+*
+* -M trims the memory the server itself holds, it is not a limit on memory:
+*
+* - the pack is a shared mapping of a file, so MADV_DONTNEED only takes its 
+*   pages out of the server; they stay in the page cache until the kernel 
+*   needs the memory for something else.
+* - only drawing is counted.  Routing and address searches read the regions 
+*   they reach without being counted, and those pages are only released if 
+*   the region is drawn later and then dropped.
+* - without a pack, every region is read into memory at startup and -M has 
+*   no effect.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "tmrs.h"
+
+
+#define MAX_REGION_RANGES   (7*NUM_GROUPS + 1 + 2*NUM_DETAIL_LEVELS)
+
+// a run of memory holding data of one region only
+struct _Range
+{
+    char *start;
+    long size;
+};
+
+static long budget = 0;             // bytes, 0 for no limit
+static long resident = 0;           // bytes of the regions in memory
+static long *region_size = NULL;
+static int *last_used = NULL;       // 0 if not in memory
+static int clock_tick = 0;
+
+
+/**
+* Sets the number of bytes of drawn regions of a pack after which the least 
+* recently drawn are released, 0 to keep them all.  See above for what this 
+* does not cover.
+*/
+void set_region_budget(long bytes)
+{
+    budget = bytes;
+}
+
+
+/* adds a range to the list unless it is empty */
+static int add_range(struct _Range *range, int n, void *start, long size)
+{
+    if (size > 0)
+    {
+        range[n].start = (char *)start;
+        range[n].size = size;
+        ++n;
+    }
+
+    return n;
+}
+
+
+/* finds the runs of memory holding the data of region r */
+static int get_region_ranges(int r, struct _Range *range)
+{
+    struct _Region *rg = &region[r];
+    struct _Chains *chains;
+    struct _Polygon *first, *last;
+    int n, i, group, level, count;
+
+    n = 0;
+    for (group = 0; group < NUM_GROUPS; group++)
+    {
+        i = rg->first_segment[group];
+        count = rg->num_segments[group];
+        n = add_range(range, n, &segment_class[i], count * sizeof(char));
+        n = add_range(range, n, &segment_street[i], count * sizeof(int));
+        n = add_range(range, n, &segment_shape[i], count * sizeof(int));
+        n = add_range(range, n, &segment_start[i], count * sizeof(struct _Coordinates));
+        n = add_range(range, n, &segment_end[i], count * sizeof(struct _Coordinates));
+        n = add_range(range, n, &segment_address[i], count * sizeof(struct _AddressRange));
+        n = add_range(range, n, &segment_box[i], count * sizeof(struct _BoundingBox));
+    }
+
+    n = add_range(range, n, &street[rg->first_street], 
+        rg->num_streets * sizeof(struct _StreetName));
+
+    // the points of a level are stored once if it is shared with the one below
+    for (level = 0; level < NUM_DETAIL_LEVELS; level++)
+    {
+        chains = shape_level[level];
+        if ((level == 0 || chains != shape_level[level-1]) && rg->num_shapes > 0)
+            n = add_range(range, n, CHAIN_POINTS(chains, rg->first_shape), 
+                (chains->first[rg->first_shape + rg->num_shapes] - 
+                 chains->first[rg->first_shape]) * sizeof(struct _Coordinates));
+
+        if ((level == 0 || polygon_level[level] != polygon_level[level-1]) && 
+            rg->num_polygons > 0)
+        {
+            first = &polygon_level[level][rg->first_polygon];
+            last = &polygon_level[level][rg->first_polygon + rg->num_polygons - 1];
+            n = add_range(range, n, first->point, 
+                (char *)(last->point + last->num_points) - (char *)first->point);
+        }
+    }
+
+    return n;
+}
+
+
+/* releases the pages holding nothing but data of region r */
+static void drop_region(int r)
+{
+    struct _Range range[MAX_REGION_RANGES];
+    long page, start, end;
+    int i, n;
+
+    page = sysconf(_SC_PAGESIZE);
+    n = get_region_ranges(r, range);
+    for (i = 0; i < n; i++)
+    {
+        if (!in_pack(range[i].start))
+            continue;
+
+        start = ((long)range[i].start + page - 1) / page * page;
+        end = ((long)range[i].start + range[i].size) / page * page;
+        if (end > start)
+            madvise((void *)start, end - start, MADV_DONTNEED);
+    }
+
+    resident -= region_size[r];
+    last_used[r] = 0;
+}
+
+
+/**
+* Sets up the bookkeeping of the regions of the dataset that was loaded, 
+* forgetting that of the one before.  Only regions mapped from a pack can 
+* be dropped, the budget does not apply to others.
+*/
+void init_regions()
+{
+    struct _Range range[MAX_REGION_RANGES];
+    int r, i, n;
+
+    free(region_size);
+    free(last_used);
+    region_size = (long *)calloc(numRegions + 1, sizeof(long));
+    last_used = (int *)calloc(numRegions + 1, sizeof(int));
+    resident = 0;
+    clock_tick = 0;
+
+    if (!pack_mapped())
+        return;
+
+    for (r = 0; r < numRegions; r++)
+    {
+        n = get_region_ranges(r, range);
+        for (i = 0; i < n; i++)
+            region_size[r] += range[i].size;
+    }
+}
+
+
+/**
+* Works out the bounding boxes of the regions of a dataset loaded from the 
+* data files, once the spatial index has been built.
+*/
+void measure_regions()
+{
+    struct _Region *rg;
+    int r, i, group, found;
+
+    for (r = 0; r < numRegions; r++)
+    {
+        rg = &region[r];
+        found = 0;
+
+        for (group = 0; group < NUM_GROUPS; group++)
+        {
+            for (i = rg->first_segment[group]; 
+                 i < rg->first_segment[group] + rg->num_segments[group]; i++)
+            {
+                if (!found)
+                    rg->bounds = segment_box[i];
+                extend_box(&rg->bounds, &segment_box[i].Min);
+                extend_box(&rg->bounds, &segment_box[i].Max);
+                found = 1;
+            }
+        }
+
+        for (i = rg->first_polygon; i < rg->first_polygon + rg->num_polygons; i++)
+        {
+            if (!found)
+                rg->bounds = polygon_box[i];
+            extend_box(&rg->bounds, &polygon_box[i].Min);
+            extend_box(&rg->bounds, &polygon_box[i].Max);
+            found = 1;
+        }
+    }
+}
+
+
+/**
+* Notes that the regions overlapping the given area are about to be drawn.  
+* If that takes the regions in memory over the budget, those drawn least 
+* recently are dropped, except the ones needed now.
+*/
+void use_regions(struct _BoundingBox *area)
+{
+    int r, oldest;
+
+    if (numRegions == 0)
+        return;
+
+    ++clock_tick;
+    for (r = 0; r < numRegions; r++)
+    {
+        if (!boxes_intersect(&region[r].bounds, area))
+            continue;
+
+        if (last_used[r] == 0)
+            resident += region_size[r];
+        last_used[r] = clock_tick;
+    }
+
+    while (budget > 0 && resident > budget)
+    {
+        oldest = -1;
+        for (r = 0; r < numRegions; r++)
+            if (last_used[r] != 0 && last_used[r] != clock_tick && 
+                (oldest < 0 || last_used[r] < last_used[oldest]))
+                oldest = r;
+
+        if (oldest < 0)
+            break;
+
+        drop_region(oldest);
+    }
+}
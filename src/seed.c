@@ -0,0 +1,205 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "tmrs.h"
+
+
+// sent from a worker process to the parent after each metatile
+struct _SeedProgress
+{
+    int tiles;
+    long bytes;
+};
+
+
+/**
+* Finds the range of tiles covering the whole dataset at a zoom level.
+*/
+void get_tile_range(int zoom, int *x1, int *y1, int *x2, int *y2)
+{
+    int last = (1 << zoom) - 1;
+
+    *x1 = (int)(mercator_x(dataset_bounds.Min.Longitude, zoom) / TILE_SIZE);
+    *x2 = (int)(mercator_x(dataset_bounds.Max.Longitude, zoom) / TILE_SIZE);
+    *y1 = (int)(mercator_y(dataset_bounds.Max.Latitude, zoom) / TILE_SIZE);
+    *y2 = (int)(mercator_y(dataset_bounds.Min.Latitude, zoom) / TILE_SIZE);
+
+    if (*x1 < 0) *x1 = 0;
+    if (*y1 < 0) *y1 = 0;
+    if (*x2 > last) *x2 = last;
+    if (*y2 > last) *y2 = last;
+}
+
+
+/**
+* Work done by each worker process.  Metatiles are numbered in the order they
+* are enumerated and worker n takes every num_workers'th one starting at n.
+*
+* Returns 0 if every tile of its metatiles was stored, -1 otherwise.
+*/
+static int seed_worker(int worker, int num_workers, int min_zoom, 
+                       int max_zoom, int fd)
+{
+    struct _SeedProgress progress;
+    int zoom, span, mx, my, x1, y1, x2, y2, job = 0, result = 0;
+
+    for (zoom = min_zoom; zoom <= max_zoom; zoom++)
+    {
+        span = get_metatile_span(zoom);
+        get_tile_range(zoom, &x1, &y1, &x2, &y2);
+
+        for (my = y1 - y1 % span; my <= y2; my += span)
+        {
+            for (mx = x1 - x1 % span; mx <= x2; mx += span)
+            {
+                if (job++ % num_workers != worker)  continue;
+
+                progress.tiles = 0;
+                progress.bytes = 0;
+                if (seed_metatile("PNG", zoom, mx, my, x1, y1, x2, y2, 
+                                  &progress.tiles, &progress.bytes) != 0)
+                    result = -1;
+                write(fd, &progress, sizeof(progress));
+            }
+        }
+    }
+
+    return result;
+}
+
+
+/**
+* Renders every tile covering the dataset from min_zoom to max_zoom into the
+* disk tile cache.  The work is split among one process per CPU.  Progress and 
+* throughput are printed as tiles are completed.
+*
+* Returns 0 if successful.
+*/
+int seed_tiles(int min_zoom, int max_zoom, char *dir)
+{
+    struct _SeedProgress progress;
+    struct timeval start, now;
+    int num_workers, worker, zoom, x1, y1, x2, y2, fds[2];
+    int percent, prev_percent = -1, status, failed = 0;
+    long long total = 0, done = 0, bytes = 0;     // the US at zoom 18 is ~2^31 tiles
+    pid_t pid;
+    double elapsed;
+
+    if (min_zoom < 0 || max_zoom > MAX_ZOOM || min_zoom > max_zoom)
+    {
+        printf("Zoom levels must be between 0 and %d.\n", MAX_ZOOM);
+        return 1;
+    }
+
+    for (zoom = min_zoom; zoom <= max_zoom; zoom++)
+    {
+        get_tile_range(zoom, &x1, &y1, &x2, &y2);
+        total += (long long)(x2 - x1 + 1) * (y2 - y1 + 1);
+    }
+
+    num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers < 1) num_workers = 1;
+
+    printf("Seeding %lld tiles (zoom %d-%d) into %s using %d processes\n", 
+        total, min_zoom, max_zoom, dir, num_workers);
+
+    if (pipe(fds) == -1)
+    {
+        perror("pipe");
+        return 1;
+    }
+
+    fflush(stdout);
+    gettimeofday(&start, NULL);
+
+    for (worker = 0; worker < num_workers; worker++)
+    {
+        pid = fork();
+        if (pid == -1)
+        {
+            // the tiles of this worker and those after it are not drawn
+            perror("fork");
+            failed = 1;
+            break;
+        }
+
+        if (pid == 0)
+        {
+            // workers only write to disk, no point keeping tiles in memory
+            close(fds[0]);
+            tile_cache_init(0, dir);
+
+            // there is already a worker per CPU, so draw in a single band
+            render_threads = 1;
+            if (seed_worker(worker, num_workers, min_zoom, max_zoom, fds[1]) != 0)
+                failed = 1;
+            close(fds[1]);
+            _exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+    }
+
+    // the read end sees EOF once every worker has exited
+    close(fds[1]);
+    while (read(fds[0], &progress, sizeof(progress)) == sizeof(progress))
+    {
+        done += progress.tiles;
+        bytes += progress.bytes;
+
+        percent = (total > 0) ? 100 * done / total : 100;
+        if (percent > prev_percent)
+        {
+            gettimeofday(&now, NULL);
+            elapsed = (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1000000.0;
+            printf("\r %3d%%  %lld/%lld tiles  %.1f tiles/s", percent, done, total, 
+                elapsed > 0.0 ? done / elapsed : 0.0);
+            fflush(stdout);
+            prev_percent = percent;
+        }
+    }
+    close(fds[0]);
+
+    // a worker that could not store all of its tiles or did not finish
+    while (wait(&status) > 0)
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            failed = 1;
+
+    gettimeofday(&now, NULL);
+    elapsed = (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1000000.0;
+
+    // print the statistics
+    printf( "\n\nSummary\n");
+    printf( "------------------------------------------------\n");
+    printf( "Tiles rendered       \t= %lld, \t%lld kB\n", done, bytes/1024);
+    printf( "Elapsed time         \t= %.1f s\n", elapsed);
+    printf( "Throughput           \t= %.1f tiles/s\n", elapsed > 0.0 ? done / elapsed : 0.0);
+    printf( "------------------------------------------------\n\n");
+
+    return (done == total && !failed) ? 0 : 1;
+}
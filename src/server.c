@@ -23,7 +23,10 @@
 
 
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -31,27 +34,75 @@
 
 #include "tmrs.h"
 
-// temporary to avoid passing a struct to gdSink
-int temp_socket;
 
+static volatile sig_atomic_t reload_requested = 0;
+static sigset_t wait_mask;      // signal mask while waiting for a request
 
-static int socketSink(void *context, char *buffer, int len)
+
+static void request_reload(int sig)
 {
-    int bytes;
+    reload_requested = 1;
+}
 
-    bytes = send(temp_socket, buffer, len, 0);
-    //printf("server: Sending %d bytes / Sent %d bytes of data\n", len, bytes);
 
-    return bytes;
+/* 
+* makes SIGHUP reload the dataset.  The signal is blocked except while 
+* waiting for a connection, so it never interrupts a request being served.
+*/
+static void catch_reload_signal()
+{
+    struct sigaction action;
+    sigset_t block;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_reload;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGHUP, &action, NULL);
+
+    sigemptyset(&block);
+    sigaddset(&block, SIGHUP);
+    sigprocmask(SIG_BLOCK, &block, &wait_mask);
+    sigdelset(&wait_mask, SIGHUP);
 }
 
 
+/* 
+* waits until a connection is ready to be accepted on sockfd.  A reload asked 
+* for meanwhile is carried out here, between two requests, so every request 
+* is served from one dataset from start to end.
+*/
+static void wait_for_request(int sockfd, char *pack_filename)
+{
+    fd_set fds;
+
+    while (1)
+    {
+        if (reload_requested)
+        {
+            reload_requested = 0;
+            if (reload_pack(pack_filename) == 0)
+                printf("server: reloaded %s\n", pack_filename);
+        }
+
+        FD_ZERO(&fds);
+        FD_SET(sockfd, &fds);
+        if (pselect(sockfd + 1, &fds, NULL, NULL, NULL, &wait_mask) > 0)
+            return;
+
+        if (errno != EINTR)
+        {
+            perror("select");
+            return;
+        }
+    }
+}
 
 /** 
 * This method start listening for connection and serving requests as they are
-* received.
+* received.  Sending the server SIGHUP makes it switch to the pack in 
+* pack_filename, see reload_pack().
 */
-void server_start()
+void server_start(char *pack_filename)
 {
     int sockfd, new_fd;  // listen on sock_fd, new connection on new_fd
     struct sockaddr_in my_addr;    // my address information
@@ -80,9 +131,12 @@ void server_start()
         exit(1);
     }
 
+    catch_reload_signal();
+
     // main server loop
     while (1) 
     {  
+        wait_for_request(sockfd, pack_filename);
         sin_size = sizeof(struct sockaddr_in);
         if ((new_fd = accept(sockfd, (struct sockaddr *)&their_addr, &sin_size)) == -1) {
             perror("accept");
@@ -113,9 +167,8 @@ void server_start()
         printf("server: received %d bytes\n", bytes_received);
 
         // setup sink information
-        temp_socket = new_fd;
-        mySink.context = NULL;
-        mySink.sink = socketSink;
+        mySink.context = &new_fd;
+        mySink.sink = fd_sink;
 
         // call the appropriate handler
         switch (buffer[0]) 
@@ -128,6 +181,14 @@ void server_start()
             handle_find_address(&buffer[2], &mySink);
             break;
 
+        case 'T':
+            handle_draw_tile(&buffer[2], &mySink);
+            break;
+
+        case 'R':
+            handle_draw_route(&buffer[2], &mySink);
+            break;
+
         default:
             send(new_fd, "Command not understood\n", 23, 0);
             break;
@@ -142,9 +203,9 @@ void server_start()
 
 /** 
 * This method start listening for connection using UNIX stream in order to 
-* avoid overhead of TCP networking.
+* avoid overhead of TCP networking.  Reloads as server_start() does.
 */
-void server_start_unix()
+void server_start_unix(char *pack_filename)
 {
     int sockfd, new_fd;  // listen on sock_fd, new connection on new_fd
     struct sockaddr_un my_addr; // my address information
@@ -172,9 +233,12 @@ void server_start_unix()
         exit(1);
     }
 
+    catch_reload_signal();
+
     // main server loop
     while (1) 
     {  
+        wait_for_request(sockfd, pack_filename);
         sun_size = sizeof(struct sockaddr_un);
         if ((new_fd = accept(sockfd, (struct sockaddr *)&their_addr, &sun_size)) == -1) {
             perror("accept");
@@ -205,9 +269,8 @@ void server_start_unix()
         printf("server: received %d bytes\n", bytes_received);
 
         // setup sink information
-        temp_socket = new_fd;
-        mySink.context = NULL;
-        mySink.sink = socketSink;
+        mySink.context = &new_fd;
+        mySink.sink = fd_sink;
 
         // call the appropriate handler
         switch (buffer[0]) 
@@ -220,6 +283,14 @@ void server_start_unix()
             handle_find_address(&buffer[2], &mySink);
             break;
 
+        case 'T':
+            handle_draw_tile(&buffer[2], &mySink);
+            break;
+
+        case 'R':
+            handle_draw_route(&buffer[2], &mySink);
+            break;
+
         default:
             send(new_fd, "Command not understood\n", 23, 0);
             break;
@@ -0,0 +1,279 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tmrs_structs.h"
+#include "simplify.h"
+#include "coords.h"
+
+
+/**
+* Returns the square of the distance from point p to the line segment a-b.
+*/
+static double distance_to_segment(struct _Coordinates *p, struct _Coordinates *a,
+                                  struct _Coordinates *b)
+{
+    double dx, dy, px, py, t;
+
+    dx = (double)b->Longitude - a->Longitude;
+    dy = (double)b->Latitude - a->Latitude;
+    px = (double)p->Longitude - a->Longitude;
+    py = (double)p->Latitude - a->Latitude;
+
+    if (dx != 0.0 || dy != 0.0)
+    {
+        t = (px*dx + py*dy) / (dx*dx + dy*dy);
+        if (t > 1.0) t = 1.0;
+        if (t > 0.0)
+        {
+            px -= t*dx;
+            py -= t*dy;
+        }
+    }
+
+    return px*px + py*py;
+}
+
+
+/**
+* Simplifies a polyline using the Douglas-Peucker algorithm.  The first and 
+* last points are always kept and no removed point is further than tolerance 
+* from the resulting line.
+*
+* in         - the points of the line
+* num_points - the number of points in the line
+* tolerance  - in the same units as the coordinates
+* out        - receives the kept points, must have room for num_points
+*
+* Returns the number of points in out.
+*/
+int simplify_points(struct _Coordinates *in, int num_points, int tolerance,
+                    struct _Coordinates *out)
+{
+    int *stack, top, first, last, i, farthest, count;
+    double d, max_d, limit;
+    char *keep;
+
+    if (num_points <= 2)
+    {
+        memcpy(out, in, num_points * sizeof(struct _Coordinates));
+        return num_points;
+    }
+
+    keep = (char *)calloc(num_points, sizeof(char));
+    stack = (int *)malloc(2 * num_points * sizeof(int));
+    limit = (double)tolerance * tolerance;
+
+    keep[0] = keep[num_points-1] = 1;
+    top = 0;
+    stack[top++] = 0;
+    stack[top++] = num_points-1;
+
+    // split each range at its farthest point until everything is close enough
+    while (top > 0)
+    {
+        last = stack[--top];
+        first = stack[--top];
+
+        max_d = -1.0;
+        farthest = -1;
+        for (i = first+1; i < last; i++)
+        {
+            d = distance_to_segment(&in[i], &in[first], &in[last]);
+            if (d > max_d)
+            {
+                max_d = d;
+                farthest = i;
+            }
+        }
+
+        if (farthest < 0 || max_d <= limit)
+            continue;
+
+        keep[farthest] = 1;
+        stack[top++] = first;
+        stack[top++] = farthest;
+        stack[top++] = farthest;
+        stack[top++] = last;
+    }
+
+    count = 0;
+    for (i = 0; i < num_points; i++)
+    {
+        if (keep[i])
+            out[count++] = in[i];
+    }
+
+    free(keep);
+    free(stack);
+
+    return count;
+}
+
+
+/**
+* Simplifies a closed ring (first point equal to the last).  The ring is split
+* at the point farthest from its start and each half is simplified on its 
+* own.  Rings that would collapse to less than a triangle are left alone.
+*
+* Returns the number of points in out.
+*/
+int simplify_ring(struct _Coordinates *in, int num_points, int tolerance,
+                  struct _Coordinates *out)
+{
+    int i, farthest = 0, count;
+    double d, max_d = -1.0;
+
+    if (num_points <= 4)
+    {
+        memcpy(out, in, num_points * sizeof(struct _Coordinates));
+        return num_points;
+    }
+
+    for (i = 1; i < num_points; i++)
+    {
+        d = distance_to_segment(&in[i], &in[0], &in[0]);
+        if (d > max_d)
+        {
+            max_d = d;
+            farthest = i;
+        }
+    }
+
+    // the two halves share the farthest point
+    count = simplify_points(in, farthest+1, tolerance, out);
+    count += simplify_points(&in[farthest], num_points-farthest, tolerance, 
+        &out[count-1]) - 1;
+
+    if (count < 4)
+    {
+        memcpy(out, in, num_points * sizeof(struct _Coordinates));
+        return num_points;
+    }
+
+    return count;
+}
+
+
+/**
+* Opens the files for the simplified copies of a data file, named 
+* <name>1.dat, <name>2.dat and so on.  Each starts with CODED_MARKER and a 
+* record count which is filled in by close_detail_files().  fp[0] is not 
+* used.
+*/
+void open_detail_files(FILE **fp, char *name)
+{
+    char filename[256];
+    int level, marker = CODED_MARKER, count = 0;
+
+    for (level = 1; level < NUM_DETAIL_LEVELS; level++)
+    {
+        sprintf(filename, "%s%d.dat", name, level);
+        fp[level] = fopen(filename, "w");
+        if (fp[level] == NULL)
+        {
+            perror(filename);
+            exit(EXIT_FAILURE);
+        }
+
+        fwrite(&marker, sizeof(int), 1, fp[level]);
+        fwrite(&count, sizeof(int), 1, fp[level]);
+    }
+}
+
+
+/**
+* Writes the final record count and closes the files opened by 
+* open_detail_files().
+*/
+void close_detail_files(FILE **fp, int count)
+{
+    int level;
+
+    for (level = 1; level < NUM_DETAIL_LEVELS; level++)
+    {
+        fseek(fp[level], sizeof(int), SEEK_SET);
+        fwrite(&count, sizeof(int), 1, fp[level]);
+        fclose(fp[level]);
+    }
+}
+
+
+/**
+* Writes a chain of shape points to each detail level, simplified with the 
+* tolerance of that level.  The end points of the segment anchor the 
+* simplification but are not written, the same as in chains.dat.  A chain 
+* may end up with no points, in which case the segment is drawn straight.
+*/
+void write_chain_levels(FILE **fp, struct _Coordinates *start, 
+                        struct _Coordinates *point, int num_points, 
+                        struct _Coordinates *end)
+{
+    struct _Coordinates *line, *out;
+    int level, count;
+
+    line = (struct _Coordinates *)malloc((num_points+2) * sizeof(struct _Coordinates));
+    out = (struct _Coordinates *)malloc((num_points+2) * sizeof(struct _Coordinates));
+
+    line[0] = *start;
+    memcpy(&line[1], point, num_points * sizeof(struct _Coordinates));
+    line[num_points+1] = *end;
+
+    for (level = 1; level < NUM_DETAIL_LEVELS; level++)
+    {
+        count = simplify_points(line, num_points+2, DETAIL_TOLERANCE(level), out) - 2;
+        write_coded_int(fp[level], count);
+        write_coded_points(fp[level], &out[1], count);
+    }
+
+    free(line);
+    free(out);
+}
+
+
+/**
+* Writes a polygon to each detail level using the polygons.dat record layout.
+*/
+void write_polygon_levels(FILE **fp, char type, char *name, 
+                          struct _Coordinates *point, int num_points)
+{
+    struct _Coordinates *out;
+    int level, count;
+
+    out = (struct _Coordinates *)malloc(num_points * sizeof(struct _Coordinates));
+
+    for (level = 1; level < NUM_DETAIL_LEVELS; level++)
+    {
+        count = simplify_ring(point, num_points, DETAIL_TOLERANCE(level), out);
+
+        fwrite(&type, sizeof(char), 1, fp[level]);
+        fwrite(name, 30, 1, fp[level]);
+        write_coded_int(fp[level], count);
+        write_coded_points(fp[level], out, count);
+    }
+
+    free(out);
+}
@@ -0,0 +1,41 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+
+#ifndef _SIMPLIFY_H
+#define _SIMPLIFY_H
+
+// functions implemented in simplify.c
+int simplify_points(struct _Coordinates *in, int num_points, int tolerance,
+                    struct _Coordinates *out);
+int simplify_ring(struct _Coordinates *in, int num_points, int tolerance,
+                  struct _Coordinates *out);
+void open_detail_files(FILE **fp, char *name);
+void close_detail_files(FILE **fp, int count);
+void write_chain_levels(FILE **fp, struct _Coordinates *start, 
+                        struct _Coordinates *point, int num_points, 
+                        struct _Coordinates *end);
+void write_polygon_levels(FILE **fp, char type, char *name, 
+                          struct _Coordinates *point, int num_points);
+
+#endif
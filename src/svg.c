@@ -0,0 +1,401 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+/*
+* SVG output of maps (format "SVG" of an 'M' request) for printing.  The map 
+* is written as it is worked out, without drawing an image first:
+*
+*   the background, then the polygons, then one group of paths per road 
+*   group (minor streets, major streets, highways) holding a casing path 
+*   and a fill path for each line style, then the route if there is one 
+*   and the street labels.
+*
+* Roads and labels are chosen and styled as on the image maps; coordinates 
+* are in pixels of the requested size with one decimal, so that the map 
+* stays sharp at any print size.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include "gd.h"
+#include "tmrs.h"
+
+
+#define SVG_BUFFER_SIZE     16384   // bytes collected before a sink write
+
+static char *group_name[NUM_GROUPS] = { "minor", "major", "highway" };
+
+
+// output collected into larger writes to the sink
+struct _SvgWriter
+{
+    gdSinkPtr sink;
+    char data[SVG_BUFFER_SIZE];
+    int size;
+    int failed;             // set once the sink fails, the rest is dropped
+    char pen[32];           // end of the current subpath, "" if none
+};
+
+
+static void svg_flush(struct _SvgWriter *w)
+{
+    if (w->size > 0 && !w->failed && sink_write(w->sink, w->data, w->size) < 0)
+        w->failed = 1;
+    w->size = 0;
+}
+
+
+static void svg_printf(struct _SvgWriter *w, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    if (w->size > SVG_BUFFER_SIZE - 256)
+        svg_flush(w);
+
+    va_start(args, fmt);
+    len = vsnprintf(&w->data[w->size], SVG_BUFFER_SIZE - w->size, fmt, args);
+    va_end(args);
+
+    if (len >= SVG_BUFFER_SIZE - w->size)
+        len = SVG_BUFFER_SIZE - w->size - 1;    // cut short, never happens
+    w->size += len;
+}
+
+
+/* writes text with the characters that are special in XML escaped */
+static void svg_text(struct _SvgWriter *w, char *text)
+{
+    for (; *text; text++)
+    {
+        if (*text == '&')
+            svg_printf(w, "&amp;");
+        else if (*text == '<')
+            svg_printf(w, "&lt;");
+        else if (*text == '>')
+            svg_printf(w, "&gt;");
+        else if (*text == '"')
+            svg_printf(w, "&quot;");
+        else
+            svg_printf(w, "%c", *text);
+    }
+}
+
+
+/* a gd true color as #rrggbb */
+static void svg_color(struct _SvgWriter *w, int color)
+{
+    svg_printf(w, "#%02x%02x%02x", gdTrueColorGetRed(color), 
+        gdTrueColorGetGreen(color), gdTrueColorGetBlue(color));
+}
+
+
+/* same as project_point(), without rounding to whole pixels */
+static void svg_point(struct _MapView *view, struct _Coordinates *m, 
+                      double *x, double *y)
+{
+    if (view->projection == PROJECTION_MERCATOR)
+    {
+        *x = mercator_x(m->Longitude, view->zoom) - view->origin_x;
+        *y = mercator_y(m->Latitude, view->zoom) - view->origin_y;
+    }
+    else
+    {
+        *x = view->width/2 + 
+            (double)(abs(view->center.Longitude) - abs(m->Longitude)) / view->scale;
+        *y = view->height/2 + 
+            (double)(view->center.Latitude - m->Latitude) / view->scale;
+    }
+}
+
+
+/* 
+* adds a point to the current path: a MoveTo (M) or LineTo (L) command with 
+* coordinates rounded to a tenth of a pixel.  A MoveTo to where the last 
+* line ended is left out, so that chains of segments become one line.
+*/
+static void svg_path_point(struct _SvgWriter *w, char command, double x, double y)
+{
+    char str[32], *p;
+    int k;
+
+    snprintf(str, sizeof(str), "%.1f %.1f", x, y);
+
+    // "12.0 3.0" is written "12 3"
+    for (k = 0; k < 2; k++)
+    {
+        p = strstr(str, ".0");
+        if (p != NULL && (p[2] == ' ' || p[2] == '\0'))
+            memmove(p, p + 2, strlen(p + 2) + 1);
+    }
+
+    if (command == 'M' && strcmp(str, w->pen) == 0)
+        return;
+
+    svg_printf(w, "%c%s", command, str);
+    strcpy(w->pen, str);
+}
+
+
+/* adds a closed subpath around a polygon to the current path */
+static void svg_polygon(struct _SvgWriter *w, struct _MapView *view, 
+                        struct _Polygon *p)
+{
+    double x, y;
+    int j;
+
+    w->pen[0] = '\0';
+    for (j = 0; j < p->num_points; j++)
+    {
+        svg_point(view, &p->point[j], &x, &y);
+        svg_path_point(w, j == 0 ? 'M' : 'L', x, y);
+    }
+    svg_printf(w, "Z");
+    w->pen[0] = '\0';
+}
+
+
+/* adds road segment i, with the shape points of the view's detail level */
+static void svg_segment(struct _SvgWriter *w, struct _MapView *view, int i)
+{
+    struct _Chains *chains;
+    struct _Coordinates *point;
+    double x, y;
+    int j, num_points;
+
+    svg_point(view, &segment_start[i], &x, &y);
+    svg_path_point(w, 'M', x, y);
+
+    if (segment_shape[i] >= 0)
+    {
+        chains = shape_level[view->detail];
+        num_points = CHAIN_LENGTH(chains, segment_shape[i]);
+        point = CHAIN_POINTS(chains, segment_shape[i]);
+        for (j = 0; j < num_points; j++)
+        {
+            svg_point(view, &point[j], &x, &y);
+            svg_path_point(w, 'L', x, y);
+        }
+    }
+
+    svg_point(view, &segment_end[i], &x, &y);
+    svg_path_point(w, 'L', x, y);
+}
+
+
+/* 
+* Writes one pass (casing or fill) of a road group: a path for each line 
+* width and color in use, holding every segment drawn with it.
+*/
+static void svg_road_pass(struct _SvgWriter *w, struct _MapView *view, 
+                          int *visible, struct _LineStyle *style, int count, 
+                          int casing)
+{
+    int j, k, width, color;
+    char *done;
+
+    done = (char *)calloc(count, 1);
+
+    for (j = 0; j < count; j++)
+    {
+        width = casing ? style[j].casing_width : style[j].fill_width;
+        color = casing ? style[j].casing_color : style[j].fill_color;
+        if (done[j] || width == 0)
+            continue;
+
+        svg_printf(w, "<path stroke=\"");
+        svg_color(w, color);
+        svg_printf(w, "\" stroke-width=\"%d\" d=\"", width);
+        w->pen[0] = '\0';
+
+        for (k = j; k < count; k++)
+        {
+            if (done[k])
+                continue;
+            if (casing && (style[k].casing_width != width || style[k].casing_color != color))
+                continue;
+            if (!casing && (style[k].fill_width != width || style[k].fill_color != color))
+                continue;
+
+            svg_segment(w, view, visible[k]);
+            done[k] = 1;
+        }
+
+        svg_printf(w, "\"/>\n");
+    }
+
+    free(done);
+}
+
+
+/* 
+* Writes one road group and adds its label candidates to view->labels, 
+* found the same way as on image maps.
+*/
+static void svg_road_group(struct _SvgWriter *w, struct _MapView *view, 
+                           int group, int *visible, int count)
+{
+    struct _LineStyle *style;
+    gdPoint *points;
+    int j, n;
+
+    style = (struct _LineStyle *)malloc(count * sizeof(struct _LineStyle));
+    n = 0;
+    for (j = 0; j < count; j++)
+    {
+        get_line_style(segment_class[visible[j]], view->scale, &style[j]);
+        if (style[j].label && get_segment_points(visible[j], view->detail) > n)
+            n = get_segment_points(visible[j], view->detail);
+    }
+
+    svg_printf(w, "<g id=\"%s\" fill=\"none\" stroke-linecap=\"round\" "
+        "stroke-linejoin=\"round\">\n", group_name[group]);
+    svg_road_pass(w, view, visible, style, count, 1);
+    svg_road_pass(w, view, visible, style, count, 0);
+    svg_printf(w, "</g>\n");
+
+    points = (gdPoint *)malloc((n > 0 ? n : 1) * sizeof(gdPoint));
+    for (j = 0; j < count; j++)
+    {
+        if (!style[j].label)
+            continue;
+
+        n = project_segment(visible[j], view, points);
+        add_chain_labels(view, visible[j], points, n);
+    }
+
+    free(points);
+    free(style);
+}
+
+
+/* layout_labels() callback writing a label as a text element */
+static void svg_label(void *context, struct _PlacedLabel *placed)
+{
+    struct _SvgWriter *w = (struct _SvgWriter *)context;
+    double degrees;
+
+    // gd turns text counter clockwise, SVG clockwise; both by whole degrees 
+    // here as the text cache rounds angles
+    degrees = floor(placed->angle * 180.0 / M_PI + 0.5);
+
+    // gd takes font sizes in points at 96 dpi
+    svg_printf(w, "<text x=\"%d\" y=\"%d\" font-size=\"%.1f\"", 
+        placed->x, placed->y, placed->size * 96.0 / 72.0);
+    if (degrees != 0.0)
+        svg_printf(w, " transform=\"rotate(%g %d %d)\"", -degrees, placed->x, placed->y);
+    svg_printf(w, ">");
+    svg_text(w, placed->text);
+    svg_printf(w, "</text>\n");
+}
+
+
+/**
+* Writes the map of the given view to the sink as an SVG document.
+*
+* Returns 0 on success, -1 if the sink failed.
+*/
+int draw_map_svg(struct _MapView *view, gdSinkPtr pSink)
+{
+    struct _SvgWriter *w;
+    struct _BoundingBox box;
+    int j, count, *visible, group, first, result;
+
+    init_map_colors();
+    view->band_top = 0;
+    view->band_height = view->height;
+    view->raster = NULL;
+    view->detail = get_detail_level(view->scale);
+    view->labels = label_set_create();
+    get_map_bounds(view, &box);
+    use_regions(&box);
+
+    w = (struct _SvgWriter *)malloc(sizeof(struct _SvgWriter));
+    w->sink = pSink;
+    w->size = 0;
+    w->failed = 0;
+
+    svg_printf(w, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    svg_printf(w, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" "
+        "viewBox=\"0 0 %d %d\">\n", view->width, view->height, view->width, view->height);
+    svg_printf(w, "<rect width=\"%d\" height=\"%d\" fill=\"", view->width, view->height);
+    svg_color(w, background);
+    svg_printf(w, "\"/>\n");
+
+    // polygons, each a path filled with its color
+    count = grid_query(&polygon_grid, &box, polygon_box, &visible);
+    svg_printf(w, "<g id=\"polygons\">\n");
+    for (j = 0; j < count; j++)
+    {
+        svg_printf(w, "<path fill=\"");
+        svg_color(w, get_polygon_color(polygon_level[view->detail][visible[j]].type));
+        svg_printf(w, "\" d=\"");
+        svg_polygon(w, view, &polygon_level[view->detail][visible[j]]);
+        svg_printf(w, "\"/>\n");
+    }
+    svg_printf(w, "</g>\n");
+    free(visible);
+
+    // the road groups in drawing order, as in draw_band()
+    count = grid_query(&segment_grid, &box, segment_box, &visible);
+    j = 0;
+    for (group = 0; group < NUM_GROUPS; group++)
+    {
+        first = j;
+        while (j < count && visible[j] < group_start[group+1])
+            ++j;
+
+        if (j > first)
+            svg_road_group(w, view, group, &visible[first], j - first);
+    }
+    free(visible);
+
+    if (view->route != NULL)
+    {
+        svg_printf(w, "<g id=\"route\" fill=\"none\" stroke-linecap=\"round\" "
+            "stroke-linejoin=\"round\">\n<path stroke=\"");
+        svg_color(w, route_color);
+        svg_printf(w, "\" stroke-width=\"%d\" d=\"", ROUTE_WIDTH);
+        w->pen[0] = '\0';
+        for (j = 0; j < view->route_length; j++)
+            svg_segment(w, view, view->route[j]);
+        svg_printf(w, "\"/>\n</g>\n");
+    }
+
+    svg_printf(w, "<g id=\"labels\" font-family=\"Arial, sans-serif\" fill=\"");
+    svg_color(w, black);
+    svg_printf(w, "\">\n");
+    layout_labels(view->labels, view->width, view->height, black, svg_label, w);
+    svg_printf(w, "</g>\n</svg>\n");
+
+    label_set_destroy(view->labels);
+    view->labels = NULL;
+
+    svg_flush(w);
+    result = w->failed ? -1 : 0;
+    free(w);
+
+    return result;
+}
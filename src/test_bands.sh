@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Checks that maps drawn in bands by several threads (-j) come out the same
+# as maps drawn in one piece, with every backend.  The maps are drawn from
+# the given data, then again from its roads with a few large polygons
+# around the point that cross the edges of the bands and of the map.
+#
+#   test_bands.sh <data directory> [latitude,longitude]
+#
+# The point defaults to the one used in the README and must lie within the
+# data.
+
+DATA=${1:?usage: test_bands.sh <data directory> [latitude,longitude]}
+CENTER=${2:-28054495,-82416015}
+TMRS=${TMRS:-./tmrs}
+ONE=/tmp/test_bands.$$.1
+MANY=/tmp/test_bands.$$.n
+POLYGONS=/tmp/test_bands.$$.d
+failed=0
+
+# writes polygons.dat with six jagged 400 point polygons, 2500 to 60000
+# units in radius around the point; awk prints the bytes as \0ooo escapes 
+# for printf %b
+make_polygons()
+{
+    awk -v center=$CENTER '
+    function put(v, n,   i) {
+        if (v < 0) v += 4294967296
+        for (i = 0; i < n; i++) { printf "\\0%03o", v % 256; v = int(v / 256) }
+    }
+    BEGIN {
+        split(center, c, ",")
+        split("0 6000 -8000 20000 -3000 1000", dy, " ")
+        split("0 -7000 5000 20000 -12000 9000", dx, " ")
+        split("9000 4000 15000 30000 2500 60000", r, " ")
+        put(6, 4); printf "\n"
+        for (p = 1; p <= 6; p++) {
+            put(p % 3, 1); put(0, 30); put(400, 4)
+            for (i = 0; i < 400; i++) {
+                a = 2 * 3.14159265 * i / 400
+                d = sin(p * 78.233 + i * 12.9898) * 43758.5453
+                d = r[p] * (0.7 + 0.3 * (d - int(d)))
+                put(int(c[2] + dx[p] + d * cos(a)), 4)
+                put(int(c[1] + dy[p] + d * sin(a)), 4)
+            }
+            printf "\n"
+        }
+    }' | while read -r line; do printf '%b' "$line"; done > $POLYGONS/polygons.dat
+}
+
+mkdir $POLYGONS || exit 1
+for file in $DATA/segments.dat $DATA/names.dat $DATA/chains*.dat; do
+    ln -s $(cd $(dirname $file) && pwd)/$(basename $file) $POLYGONS/
+done
+make_polygons
+
+for data in $DATA $POLYGONS; do
+    for backend in gd scanline scanline-aa; do
+        for map in 640,480,5 1000,1003,3 800,1200,20 1200,1200,100; do
+            request=RAW,${map},${CENTER}
+            [ $data = $POLYGONS ] && request="$request with polygons"
+            if ! $TMRS -d $data -b $backend -j 1 -m RAW,$map,$CENTER > $ONE ||
+               ! $TMRS -d $data -b $backend -j 7 -m RAW,$map,$CENTER > $MANY; then
+                echo "FAIL  $backend $request: tmrs failed"
+                failed=1
+            elif cmp -s $ONE $MANY; then
+                echo "ok    $backend $request"
+            else
+                echo "FAIL  $backend $request: bands differ from one piece"
+                failed=1
+            fi
+        done
+    done
+done
+
+rm -f $ONE $MANY
+rm -rf $POLYGONS
+exit $failed
@@ -0,0 +1,267 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+/*
+* Cache of rendered label text.  Drawing a street name with FreeType means 
+* opening the font and rasterizing every glyph, and labels used to do that 
+* twice (to measure and to draw).  Instead each distinct (text, size, angle, 
+* color) is drawn once onto a transparent bitmap which is then blended onto 
+* every map that needs it.  Angles are rounded to TEXT_ANGLE_STEPS per turn 
+* so that labels of a street running across many tiles share one bitmap.
+*
+* Labels are placed by a single thread (see render_map()), so the cache 
+* needs no locking.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "gd.h"
+#include "tmrs.h"
+
+
+#define TEXT_HASH_SIZE      1024
+#define TEXT_CACHE_LIMIT    (4*1024*1024)   // bytes of bitmaps kept
+#define TEXT_ANGLE_STEPS    360             // one degree
+
+// a string drawn onto a transparent bitmap
+struct _TextImage
+{
+    char text[64];
+    float size;
+    int angle;                  // in TEXT_ANGLE_STEPS
+    int color;
+    int brect[8];               // bounding corners, drawn at (0,0)
+    int left, top;              // position of the bitmap relative to (0,0)
+    int width, height;
+    int *pixels;                // NULL if the font could not be used
+    int bytes;
+    struct _TextImage *hash_next;       // next text in the same hash bucket
+    struct _TextImage *prev, *next;     // LRU list, most recently used first
+};
+
+static struct _TextImage *bucket[TEXT_HASH_SIZE];
+static struct _TextImage *lru_head = NULL, *lru_tail = NULL;
+static int cache_used = 0;
+
+
+static unsigned int text_hash(char *text, float size, int angle, int color)
+{
+    unsigned int h = 2166136261u;
+
+    while (*text)
+        h = (h ^ (unsigned char)*text++) * 16777619u;
+
+    h ^= (unsigned int)(size * 4) * 0x9E3779B1u;
+    h ^= (unsigned int)angle * 0x85EBCA77u;
+    h ^= (unsigned int)color * 0xC2B2AE3Du;
+
+    return (h ^ (h >> 15)) % TEXT_HASH_SIZE;
+}
+
+
+/* unlinks a text from the LRU list */
+static void lru_remove(struct _TextImage *t)
+{
+    if (t->prev) t->prev->next = t->next; else lru_head = t->next;
+    if (t->next) t->next->prev = t->prev; else lru_tail = t->prev;
+    t->prev = t->next = NULL;
+}
+
+
+/* puts a text at the front of the LRU list */
+static void lru_add(struct _TextImage *t)
+{
+    t->prev = NULL;
+    t->next = lru_head;
+    if (lru_head) lru_head->prev = t;
+    lru_head = t;
+    if (lru_tail == NULL) lru_tail = t;
+}
+
+
+/* drops the least recently used texts until another size bytes fit */
+static void evict_texts(int size)
+{
+    struct _TextImage *t, **pp;
+
+    while (cache_used + size > TEXT_CACHE_LIMIT && lru_tail != NULL)
+    {
+        t = lru_tail;
+        lru_remove(t);
+
+        pp = &bucket[text_hash(t->text, t->size, t->angle, t->color)];
+        while (*pp != t)
+            pp = &(*pp)->hash_next;
+        *pp = t->hash_next;
+
+        cache_used -= t->bytes;
+        free(t->pixels);
+        free(t);
+    }
+}
+
+
+/**
+* Draws a text with FreeType onto a new transparent bitmap.
+*/
+static void render_text(struct _TextImage *t, char *font, double angle)
+{
+    gdImagePtr im;
+    int i, right, bottom, brect[8];
+
+    t->pixels = NULL;
+    t->bytes = sizeof(struct _TextImage);
+
+    if (gdImageStringFT(NULL, t->brect, 0, font, t->size, angle, 0, 0, t->text) != NULL)
+        return;
+
+    // leave a pixel around the corners for anti-aliasing
+    t->left = right = t->brect[0];
+    t->top = bottom = t->brect[1];
+    for (i = 2; i < 8; i += 2)
+    {
+        if (t->brect[i] < t->left) t->left = t->brect[i];
+        if (t->brect[i] > right) right = t->brect[i];
+        if (t->brect[i+1] < t->top) t->top = t->brect[i+1];
+        if (t->brect[i+1] > bottom) bottom = t->brect[i+1];
+    }
+    t->left -= 1;
+    t->top -= 1;
+    t->width = right - t->left + 2;
+    t->height = bottom - t->top + 2;
+
+    im = gdImageCreateTrueColor(t->width, t->height);
+    gdImageAlphaBlending(im, 0);
+    gdImageFilledRectangle(im, 0, 0, t->width, t->height, 
+        gdTrueColorAlpha(0, 0, 0, gdAlphaTransparent));
+    gdImageAlphaBlending(im, 1);
+
+    gdImageStringFT(im, brect, t->color, font, t->size, angle, 
+        -t->left, -t->top, t->text);
+
+    t->pixels = (int *)malloc(t->width * t->height * sizeof(int));
+    for (i = 0; i < t->height; i++)
+        memcpy(&t->pixels[i * t->width], im->tpixels[i], t->width * sizeof(int));
+    t->bytes += t->width * t->height * sizeof(int);
+
+    gdImageDestroy(im);
+}
+
+
+/**
+* Returns the text drawn in the given font, size (in points), angle (in 
+* radians) and color, drawing it if it is not in the cache yet.  Its brect 
+* holds the corners of the text as gdImageStringFT() gives them for text 
+* drawn at (0,0).  The result stays valid until the next call.
+*
+* Returns NULL if the font could not be used.
+*/
+struct _TextImage *get_text_image(char *font, char *text, double size, 
+                                  double angle, int color)
+{
+    struct _TextImage *t;
+    unsigned int h;
+    int step;
+
+    step = (int)floor(angle * TEXT_ANGLE_STEPS / (2 * M_PI) + 0.5);
+    h = text_hash(text, (float)size, step, color);
+
+    for (t = bucket[h]; t != NULL; t = t->hash_next)
+    {
+        if (t->angle == step && t->size == (float)size && t->color == color && 
+            !strcmp(t->text, text))
+        {
+            lru_remove(t);
+            lru_add(t);
+            return (t->pixels != NULL) ? t : NULL;
+        }
+    }
+
+    t = (struct _TextImage *)malloc(sizeof(struct _TextImage));
+    strncpy(t->text, text, sizeof(t->text)-1);
+    t->text[sizeof(t->text)-1] = '\0';
+    t->size = (float)size;
+    t->angle = step;
+    t->color = color;
+    render_text(t, font, step * 2 * M_PI / TEXT_ANGLE_STEPS);
+
+    evict_texts(t->bytes);
+    t->hash_next = bucket[h];
+    bucket[h] = t;
+    lru_add(t);
+    cache_used += t->bytes;
+
+    return (t->pixels != NULL) ? t : NULL;
+}
+
+
+/* returns the corners of a cached text, see get_text_image() */
+int *get_text_brect(struct _TextImage *t)
+{
+    return t->brect;
+}
+
+
+/**
+* Blends a cached text onto an image, with (x,y) taking the place of (0,0).
+*/
+void draw_text_image(gdImagePtr im, struct _TextImage *t, int x, int y)
+{
+    int i, j, x1, y1, a, src, dst, r, g, b;
+    int *row;
+
+    x1 = x + t->left;
+    y1 = y + t->top;
+
+    for (i = 0; i < t->height; i++)
+    {
+        if (y1 + i < 0 || y1 + i >= im->sy)
+            continue;
+        row = im->tpixels[y1 + i];
+
+        for (j = 0; j < t->width; j++)
+        {
+            if (x1 + j < 0 || x1 + j >= im->sx)
+                continue;
+
+            src = t->pixels[i * t->width + j];
+            a = gdTrueColorGetAlpha(src);
+            if (a == gdAlphaTransparent)
+                continue;
+            if (a == gdAlphaOpaque)
+            {
+                row[x1 + j] = src;
+                continue;
+            }
+
+            // mix by the opacity of the text pixel
+            dst = row[x1 + j];
+            r = (gdTrueColorGetRed(src) * (gdAlphaMax - a) + gdTrueColorGetRed(dst) * a) / gdAlphaMax;
+            g = (gdTrueColorGetGreen(src) * (gdAlphaMax - a) + gdTrueColorGetGreen(dst) * a) / gdAlphaMax;
+            b = (gdTrueColorGetBlue(src) * (gdAlphaMax - a) + gdTrueColorGetBlue(dst) * a) / gdAlphaMax;
+            row[x1 + j] = gdTrueColor(r, g, b);
+        }
+    }
+}
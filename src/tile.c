@@ -0,0 +1,275 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "gd.h"
+#include "tmrs.h"
+
+
+// The most recently rendered metatile.  Requests for any of its tiles are 
+// cut out of it instead of being drawn again.
+static gdImagePtr metatile = NULL;
+static int metatile_zoom, metatile_x, metatile_y;
+
+
+/**
+* Returns the number of tiles along each side of a metatile.  At low zoom 
+* levels the whole world is smaller than METATILE_SIZE tiles.
+*/
+int get_metatile_span(int zoom)
+{
+    return ((1 << zoom) < METATILE_SIZE) ? (1 << zoom) : METATILE_SIZE;
+}
+
+
+/**
+* Sets up a mercator view covering a block of tiles.
+*
+* zoom    - zoom level
+* x, y    - the top left tile of the block
+* span    - the number of tiles along each side of the block
+*/
+void get_tile_view(struct _MapView *view, int zoom, int x, int y, int span)
+{
+    view->projection = PROJECTION_MERCATOR;
+    view->zoom = zoom;
+    view->width = span * TILE_SIZE;
+    view->height = span * TILE_SIZE;
+    view->origin_x = (double)x * TILE_SIZE;
+    view->origin_y = (double)y * TILE_SIZE;
+    view->route = NULL;
+    view->route_length = 0;
+
+    // the style uses the number of coordinate units per pixel at the equator
+    view->scale = (int)(360000000.0 / (double)(TILE_SIZE << zoom));
+    if (view->scale < 1) view->scale = 1;
+}
+
+
+/**
+* Makes sure the metatile containing the given tile has been rendered.  All 
+* labels and geometry are drawn once for the whole block so that they line 
+* up across tile edges.
+*/
+static void render_metatile(int zoom, int x, int y)
+{
+    struct _MapView view;
+    int span;
+
+    span = get_metatile_span(zoom);
+    x -= x % span;
+    y -= y % span;
+
+    if (metatile != NULL && metatile_zoom == zoom && 
+        metatile_x == x && metatile_y == y)
+        return;
+
+    if (metatile != NULL)
+        gdImageDestroy(metatile);
+
+    get_tile_view(&view, zoom, x, y, span);
+    metatile = render_map(&view);
+    metatile_zoom = zoom;
+    metatile_x = x;
+    metatile_y = y;
+}
+
+
+/**
+* Forgets the current metatile, for when the dataset changes.
+*/
+void drop_metatile()
+{
+    if (metatile != NULL)
+        gdImageDestroy(metatile);
+    metatile = NULL;
+}
+
+
+/**
+* Copies one tile out of the current metatile into a new image.
+*/
+static gdImagePtr cut_tile(int x, int y)
+{
+    gdImagePtr im;
+    int i, left, top;
+
+    im = gdImageCreateTrueColor(TILE_SIZE, TILE_SIZE);
+    left = (x - metatile_x) * TILE_SIZE;
+    top = (y - metatile_y) * TILE_SIZE;
+
+    for (i = 0; i < TILE_SIZE; i++)
+        memcpy(im->tpixels[i], &metatile->tpixels[top + i][left], 
+            TILE_SIZE * sizeof(int));
+
+    return im;
+}
+
+
+/**
+* Returns a new image of a single tile, drawing its metatile if needed.
+*/
+gdImagePtr get_tile_image(int zoom, int x, int y)
+{
+    render_metatile(zoom, x, y);
+
+    return cut_tile(x, y);
+}
+
+
+/**
+* Cuts a tile out of the current metatile and encodes it into memory.  
+* Returns 0 on success, in which case buffer->data must be freed by the caller.
+*/
+static int encode_tile(char *format, int x, int y, struct _Buffer *buffer)
+{
+    gdImagePtr im;
+    gdSink bufferSink;
+
+    memset(buffer, 0, sizeof(struct _Buffer));
+    bufferSink.context = buffer;
+    bufferSink.sink = buffer_sink;
+
+    im = cut_tile(x, y);
+    image_to_sink(im, format, &bufferSink);
+    gdImageDestroy(im);
+
+    return (buffer->size > 0) ? 0 : -1;
+}
+
+
+/**
+* Draws a standard map tile (TILE_SIZE square, spherical mercator) and sends 
+* it to the sink.  Tiles are served from the tile cache when possible and 
+* added to it otherwise.
+*
+* format  - the output file type, see encode.c, or MVT for a vector tile
+* zoom    - zoom level from 0 to MAX_ZOOM
+* x, y    - the tile column and row, (0,0) being the north west corner
+*
+* Returns 0 on success, -1 if the tile or the format does not exist.
+*/
+int draw_tile(char *format, int zoom, int x, int y, gdSink *pSink)
+{
+    gdImagePtr im;
+    struct _Buffer buffer;
+    int i;
+
+    if (zoom < 0 || zoom > MAX_ZOOM) return -1;
+    if (x < 0 || y < 0 || x >= (1 << zoom) || y >= (1 << zoom)) return -1;
+
+    // tiles are cached under the name of their format as spelled here, so 
+    // that "png" and "PNG" are the same tile and no other names get in
+    if (strcasecmp(format, "MVT") == 0)
+        format = "MVT";
+    else if ((i = get_encoder(format)) >= 0)
+        format = get_encoder_name(i);
+    else
+        return -1;
+
+    if (tile_cache_get(format, zoom, x, y, pSink))
+        return 0;
+
+    // vector tiles are built from the data, not cut out of a metatile
+    if (strcmp(format, "MVT") == 0)
+    {
+        if (encode_vector_tile(zoom, x, y, &buffer) < 0)
+            return -1;
+
+        sink_write(pSink, buffer.data, buffer.size);
+        if (tile_cache_enabled())
+            tile_cache_put(format, zoom, x, y, buffer.data, buffer.size);
+        else
+            free(buffer.data);
+        return 0;
+    }
+
+    render_metatile(zoom, x, y);
+
+    if (!tile_cache_enabled())
+    {
+        im = cut_tile(x, y);
+        image_to_sink(im, format, pSink);
+        gdImageDestroy(im);
+        return 0;
+    }
+
+    // encode into memory so that the tile can be cached
+    if (encode_tile(format, x, y, &buffer) < 0)
+        return -1;
+
+    sink_write(pSink, buffer.data, buffer.size);
+    tile_cache_put(format, zoom, x, y, buffer.data, buffer.size);
+
+    return 0;
+}
+
+
+/**
+* Renders the metatile whose top left tile is (mx,my) and stores all of its 
+* tiles that fall within columns x1..x2 and rows y1..y2 in the tile cache.  
+* Used to fill the cache ahead of time.
+*
+* Adds the number of tiles written to the disk cache to *tiles and their 
+* size to *bytes.  Returns 0 if every tile was written, -1 otherwise.
+*/
+int seed_metatile(char *format, int zoom, int mx, int my, 
+                  int x1, int y1, int x2, int y2, int *tiles, long *bytes)
+{
+    struct _Buffer buffer;
+    int x, y, span, result = 0;
+
+    span = get_metatile_span(zoom);
+    if (x1 < mx) x1 = mx;
+    if (y1 < my) y1 = my;
+    if (x2 > mx + span - 1) x2 = mx + span - 1;
+    if (y2 > my + span - 1) y2 = my + span - 1;
+
+    render_metatile(zoom, mx, my);
+
+    for (y = y1; y <= y2; y++)
+    {
+        for (x = x1; x <= x2; x++)
+        {
+            if (encode_tile(format, x, y, &buffer) < 0)
+            {
+                result = -1;
+                continue;
+            }
+
+            if (tile_cache_put(format, zoom, x, y, buffer.data, buffer.size) == 0)
+            {
+                *bytes += buffer.size;
+                ++*tiles;
+            }
+            else
+                result = -1;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,373 @@
+/*****************************************************************************
+*                                                                           *
+* Tiger Mapping and Routing Server  (TMRS)                                  *
+*                                                                           *
+* Copyright (C) 2003 Sumit Birla <sbirla@users.sourceforge.net>             *
+*                                                                           *
+*                                                                           *
+* This program is free software; you can redistribute it and/or modify      *
+* it under the terms of the GNU General Public License as published by      *
+* the Free Software Foundation; either version 2 of the License, or         *
+* (at your option) any later version.                                       *
+*                                                                           *
+* This program is distributed in the hope that it will be useful,           *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of            *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the             *
+* GNU General Public License for more details.                              *
+*                                                                           *
+* You should have received a copy of the GNU General Public License         *
+* along with this program; if not, write to the Free Software               *
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA  *
+*                                                                           *
+*****************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "tmrs.h"
+
+
+#define TILE_HASH_SIZE  4096
+
+// an encoded tile held in memory
+struct _CachedTile
+{
+    int zoom, x, y;
+    char format[8];
+    char *data;
+    int size;
+    struct _CachedTile *hash_next;      // next tile in the same hash bucket
+    struct _CachedTile *prev, *next;    // LRU list, most recently used first
+};
+
+static struct _CachedTile *bucket[TILE_HASH_SIZE];
+static struct _CachedTile *lru_head = NULL, *lru_tail = NULL;
+static int cache_limit = 0, cache_used = 0;
+static char *cache_dir = NULL;
+
+
+/**
+* Sets up the tile cache.  
+*
+* memory_limit - the number of bytes of encoded tiles to keep in memory. 
+*                Zero disables the memory cache.
+* dir          - directory in which tiles are stored on disk, NULL disables 
+*                the disk cache.
+*/
+void tile_cache_init(int memory_limit, char *dir)
+{
+    cache_limit = memory_limit;
+    cache_dir = dir;
+}
+
+
+static unsigned int tile_hash(char *format, int zoom, int x, int y)
+{
+    unsigned int h;
+
+    h = (unsigned int)zoom * 0x9E3779B1u;
+    h ^= (unsigned int)x * 0x85EBCA77u;
+    h ^= (unsigned int)y * 0xC2B2AE3Du;
+    h ^= (unsigned int)format[0] << 8;
+
+    return (h ^ (h >> 15)) % TILE_HASH_SIZE;
+}
+
+
+/**
+* Builds the name of the file holding a tile in the disk cache: 
+*
+*      <dir>/<style version>[-<backend>][-<pack>]/<zoom>/<x>/<y>.<format>
+*
+* Tiles drawn by a backend other than libgd carry its name, and tiles drawn 
+* from a pack carry its header checksum, so that a server reloaded with new 
+* data does not serve tiles drawn from the old one.
+*/
+void get_tile_path(char *path, char *format, int zoom, int x, int y)
+{
+    int i, len;
+
+    len = sprintf(path, "%s/%d", cache_dir, MAP_STYLE_VERSION);
+    if (render_backend != BACKEND_GD)
+        len += sprintf(path+len, "-%s", get_backend_name(render_backend));
+    if (pack_mapped())
+        len += sprintf(path+len, "-%08x", pack_id());
+    len += sprintf(path+len, "/%d/%d/%d.", zoom, x, y);
+
+    for (i = 0; format[i] && i < 7; i++)
+        path[len+i] = tolower(format[i]);
+    path[len+i] = '\0';
+}
+
+
+/* unlinks a tile from the LRU list */
+static void lru_remove(struct _CachedTile *t)
+{
+    if (t->prev) t->prev->next = t->next; else lru_head = t->next;
+    if (t->next) t->next->prev = t->prev; else lru_tail = t->prev;
+    t->prev = t->next = NULL;
+}
+
+
+/* puts a tile at the front of the LRU list */
+static void lru_add(struct _CachedTile *t)
+{
+    t->prev = NULL;
+    t->next = lru_head;
+    if (lru_head) lru_head->prev = t;
+    lru_head = t;
+    if (lru_tail == NULL) lru_tail = t;
+}
+
+
+/* drops the least recently used tiles until the cache fits its limit */
+static void evict_tiles()
+{
+    struct _CachedTile *t, **pp;
+
+    while (cache_used > cache_limit && lru_tail != NULL)
+    {
+        t = lru_tail;
+        lru_remove(t);
+
+        pp = &bucket[tile_hash(t->format, t->zoom, t->x, t->y)];
+        while (*pp != t)
+            pp = &(*pp)->hash_next;
+        *pp = t->hash_next;
+
+        cache_used -= t->size;
+        free(t->data);
+        free(t);
+    }
+}
+
+
+/* adds an encoded tile to the memory cache, which takes over the data */
+static void memory_cache_add(char *format, int zoom, int x, int y, 
+                             char *data, int size)
+{
+    struct _CachedTile *t;
+    unsigned int h;
+
+    if (size > cache_limit)
+    {
+        free(data);
+        return;
+    }
+
+    t = (struct _CachedTile *)malloc(sizeof(struct _CachedTile));
+    t->zoom = zoom;
+    t->x = x;
+    t->y = y;
+    strncpy(t->format, format, sizeof(t->format)-1);
+    t->format[sizeof(t->format)-1] = '\0';
+    t->data = data;
+    t->size = size;
+
+    h = tile_hash(format, zoom, x, y);
+    t->hash_next = bucket[h];
+    bucket[h] = t;
+    lru_add(t);
+
+    cache_used += size;
+    evict_tiles();
+}
+
+
+static struct _CachedTile *memory_cache_find(char *format, int zoom, int x, int y)
+{
+    struct _CachedTile *t;
+
+    t = bucket[tile_hash(format, zoom, x, y)];
+    for (; t != NULL; t = t->hash_next)
+    {
+        if (t->zoom == zoom && t->x == x && t->y == y && 
+            !strncmp(t->format, format, sizeof(t->format)-1))
+            return t;
+    }
+
+    return NULL;
+}
+
+
+/* reads a tile from the disk cache, returns NULL if it is not there */
+static char *disk_cache_read(char *format, int zoom, int x, int y, int *size)
+{
+    char path[512], *data;
+    struct stat st;
+    FILE *fp;
+
+    get_tile_path(path, format, zoom, x, y);
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+        return NULL;
+
+    fstat(fileno(fp), &st);
+    data = (char *)malloc(st.st_size > 0 ? st.st_size : 1);
+    *size = fread(data, 1, st.st_size, fp);
+    fclose(fp);
+
+    if (*size != st.st_size || *size == 0)
+    {
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+
+/**
+* Creates all directories leading up to the given file.
+*/
+void make_parent_dirs(char *path)
+{
+    char dir[512], *p;
+
+    strncpy(dir, path, sizeof(dir)-1);
+    dir[sizeof(dir)-1] = '\0';
+
+    for (p = strchr(dir + 1, '/'); p != NULL; p = strchr(p + 1, '/'))
+    {
+        *p = '\0';
+        mkdir(dir, 0755);
+        *p = '/';
+    }
+}
+
+
+/* 
+* writes a tile to the disk cache.  The tile is written to a temporary file 
+* first and renamed so that readers never see a partial tile.  Returns 0 if 
+* the tile was stored, -1 otherwise.
+*/
+static int disk_cache_write(char *format, int zoom, int x, int y, 
+                            char *data, int size)
+{
+    char path[512], temp[540];
+    FILE *fp;
+
+    get_tile_path(path, format, zoom, x, y);
+    sprintf(temp, "%s.%d", path, (int)getpid());
+
+    fp = fopen(temp, "wb");
+    if (fp == NULL)
+    {
+        make_parent_dirs(path);
+        fp = fopen(temp, "wb");
+        if (fp == NULL)
+        {
+            perror(temp);
+            return -1;
+        }
+    }
+
+    // a full disk may only show when the buffered data is flushed on close
+    if (fwrite(data, 1, size, fp) != size)
+    {
+        perror(temp);
+        fclose(fp);
+        unlink(temp);
+        return -1;
+    }
+
+    if (fclose(fp) != 0 || rename(temp, path) != 0)
+    {
+        perror(temp);
+        unlink(temp);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+* Looks for a tile in memory and then on disk.  Tiles found on disk are moved
+* into the memory cache.
+*
+* Returns 1 and sends the tile to the sink if it was found, 0 otherwise.
+*/
+int tile_cache_get(char *format, int zoom, int x, int y, gdSinkPtr pSink)
+{
+    struct _CachedTile *t;
+    char *data;
+    int size;
+
+    t = memory_cache_find(format, zoom, x, y);
+    if (t != NULL)
+    {
+        lru_remove(t);
+        lru_add(t);
+        sink_write(pSink, t->data, t->size);
+        return 1;
+    }
+
+    if (cache_dir == NULL)
+        return 0;
+
+    data = disk_cache_read(format, zoom, x, y, &size);
+    if (data == NULL)
+        return 0;
+
+    sink_write(pSink, data, size);
+    memory_cache_add(format, zoom, x, y, data, size);
+
+    return 1;
+}
+
+
+/**
+* Stores an encoded tile in the cache.  The cache takes over the data, which 
+* must have been allocated with malloc().
+*
+* Returns 0, or -1 if the tile could not be written to the disk cache.
+*/
+int tile_cache_put(char *format, int zoom, int x, int y, char *data, int size)
+{
+    int result = 0;
+
+    if (cache_dir != NULL)
+        result = disk_cache_write(format, zoom, x, y, data, size);
+
+    memory_cache_add(format, zoom, x, y, data, size);
+
+    return result;
+}
+
+
+/**
+* Drops every tile held in memory, for when the dataset changes.  Tiles in 
+* the disk cache are left alone; they are filed under the old pack, see 
+* get_tile_path().
+*/
+void tile_cache_clear()
+{
+    struct _CachedTile *t;
+
+    while (lru_head != NULL)
+    {
+        t = lru_head;
+        lru_head = t->next;
+        free(t->data);
+        free(t);
+    }
+
+    lru_tail = NULL;
+    memset(bucket, 0, sizeof(bucket));
+    cache_used = 0;
+}
+
+
+/**
+* Returns true if tiles are being cached at all.
+*/
+int tile_cache_enabled()
+{
+    return (cache_limit > 0 || cache_dir != NULL);
+}
@@ -26,15 +26,21 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "gd.h"
 #include "tmrs.h"
+#include "coords.h"
 
 // function prototypes
 void print_address(char *name, char *type);
+struct _RoadSegment *read_segments_file(char *, int *);
 void load_segments_file(char *);
-void load_shapes_file(char *);
+struct _Chains *load_shapes_file(char *, int *);
 void load_names_file(char *);
-void load_polygons_file(char *);
+struct _Polygon *load_polygons_file(char *, int *);
+void load_detail_levels(char *);
+struct _BoundingBox *load_boxes_file(char *, char *);
+void group_segments(struct _RoadSegment *);
 int find_closest_highway(struct _Coordinates *m);
 
 
@@ -49,11 +55,17 @@ int main(int argc, char **argv)
 {
     int i, source, destination, waypoint1, waypoint2, optchar;
     int run_server = 0;
+    int cache_size = 8192;   // kilobytes of tiles kept in memory
+    char *cache_dir = NULL, *seed_string = NULL, *bench_string = NULL;
+    int min_zoom, max_zoom, result = EXIT_SUCCESS;
     float d;
     char *data_dir = "./";   // default directory
-    char str[64], *street = NULL, *map_string = NULL;
+    char str[64], *street = NULL, *map_string = NULL, *tile_string = NULL;
+    char *route_string = NULL;
+    int make_pack = 0, pack_loaded = 0;
     char segments_filename[256], names_filename[256], shapes_filename[256];
-    char polygons_filename[256];
+    char polygons_filename[256], boxes_filename[256], pack_filename[256];
+    char regions_filename[256];
     gdSink mySink;
     FILE *fp;
 
@@ -63,8 +75,20 @@ int main(int argc, char **argv)
     *  -s <run as server>
     *  -m <comma_separated_map_string>
     *  -a <comma_separated_street_address>
+    *  -t <comma_separated_tile_string>
+    *  -r <comma_separated_route_string>
+    *  -c <kilobytes of memory used to cache tiles>
+    *  -C <directory in which to cache tiles>
+    *  -p <max_zoom or min_zoom-max_zoom to pre-render into the cache directory>
+    *  -b <drawing backend: gd (default), scanline or scanline-aa>
+    *  -j <threads drawing each map with a scanline backend, default is one per CPU>
+    *  -z <png compression: level 0-9 and optional zlib strategy>
+    *  -B <zoom level at which to compare the tile encoders>
+    *  -P <pack the data files into a single file that loads instantly>
+    *  -M <megabytes of drawn regions of a pack after which some are released, see region.c>
+    *  -V <check every section of the pack against its checksum when loading it>
     */
-    while ((optchar = getopt (argc, argv, "d:a:m:s")) != -1)
+    while ((optchar = getopt (argc, argv, "d:a:m:t:r:c:C:p:b:j:z:B:PM:Vs")) != -1)
     {
         switch (optchar)
         {
@@ -84,56 +108,167 @@ int main(int argc, char **argv)
             map_string = (char *) strdup (optarg);
             break;
 
+        case 't':
+            tile_string = (char *) strdup (optarg);
+            break;
+
+        case 'r':
+            route_string = (char *) strdup (optarg);
+            break;
+
+        case 'c':
+            cache_size = atoi(optarg);
+            break;
+
+        case 'C':
+            cache_dir = (char *) strdup (optarg);
+            break;
+
+        case 'p':
+            seed_string = (char *) strdup (optarg);
+            break;
+
+        case 'b':
+            render_backend = get_backend(optarg);
+            if (render_backend < 0)
+            {
+                printf("Unknown backend %s.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'j':
+            render_threads = atoi(optarg);
+            break;
+
+        case 'z':
+            if (set_png_compression(optarg) < 0)
+            {
+                printf("Invalid compression %s.\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'B':
+            bench_string = (char *) strdup (optarg);
+            break;
+
+        case 'P':
+            make_pack = 1;
+            break;
+
+        case 'M':
+            set_region_budget(atol(optarg) * 1024 * 1024);
+            break;
+
+        case 'V':
+            set_pack_verification(1);
+            break;
+
         default:
         case '?':
-            printf ("Usage: %s [-d datadir] [-s] [-a address_string] [-m map_string]\n\n", argv[0]);
+            printf ("Usage: %s [-d datadir] [-s] [-a address_string] [-m map_string] [-t tile_string]\n"
+                    "       [-r route_string]\n"
+                    "       [-c cache_kb] [-C cache_dir] [-p [min_zoom-]max_zoom]\n"
+                    "       [-b gd|scanline|scanline-aa] [-j threads]\n"
+                    "       [-z level[,default|filtered|huffman|rle|fixed]] [-B zoom] [-P]\n"
+                    "       [-M region_mb] [-V]\n\n", argv[0]);
             return EXIT_FAILURE;
         }
     }
 
+    // pre-rendering writes into the disk cache, so it must be given
+    if (seed_string != NULL && cache_dir == NULL)
+    {
+        printf("A cache directory (-C) is required with -p.\n");
+        return EXIT_FAILURE;
+    }
+
     // initialize pointers used in A* Search
     open_list_head = NULL;
     closed_list_head = NULL;
 
-    // makes sure these files exist, otherwise you get a segmentation fault!
-    sprintf(segments_filename, "%s/%s", data_dir, "segments.dat");
-    sprintf(names_filename, "%s/%s", data_dir, "names.dat");
-    sprintf(shapes_filename, "%s/%s", data_dir, "chains.dat");
-    sprintf(polygons_filename, "%s/%s", data_dir, "polygons.dat");
-    load_segments_file(segments_filename);
-    load_names_file(names_filename);
-    load_shapes_file(shapes_filename);
-    load_polygons_file(polygons_filename);
+    // use the packed dataset if there is one (and it is not being rebuilt)
+    sprintf(pack_filename, "%s/%s", data_dir, PACK_FILENAME);
+    if (!make_pack)
+        pack_loaded = (load_pack(pack_filename) == 0);
+
+    sprintf(regions_filename, "%s/%s", data_dir, REGIONS_FILENAME);
+    if (!pack_loaded && access(regions_filename, R_OK) == 0)
+        load_regions(data_dir, regions_filename);
+    else if (!pack_loaded)
+    {
+        // makes sure these files exist, otherwise you get a segmentation fault!
+        sprintf(segments_filename, "%s/%s", data_dir, "segments.dat");
+        sprintf(names_filename, "%s/%s", data_dir, "names.dat");
+        sprintf(shapes_filename, "%s/%s", data_dir, "chains.dat");
+        sprintf(polygons_filename, "%s/%s", data_dir, "polygons.dat");
+        sprintf(boxes_filename, "%s/%s", data_dir, "polygon_boxes.dat");
+        load_segments_file(segments_filename);
+        load_names_file(names_filename);
+        shape = load_shapes_file(shapes_filename, &numShapes);
+        polygon = load_polygons_file(polygons_filename, &numPolygons);
+        load_detail_levels(data_dir);
+        polygon_box = load_boxes_file(boxes_filename, polygons_filename);
+    }
+    build_spatial_index();
+    if (!pack_loaded)
+        measure_regions();
+    init_regions();
+
+    tile_cache_init(cache_size * 1024, cache_dir);
 
     mySink.context = (void *) stdout;
     mySink.sink = stdioSink;
 
-    if (run_server == 1)        // run as server? (-s option on command line)
-        server_start();
+    if (make_pack)
+    {
+        if (write_pack(pack_filename) != 0)
+            result = EXIT_FAILURE;
+    }
+    else if (run_server == 1)   // run as server? (-s option on command line)
+        server_start(pack_filename);
     else if (street != NULL)    // address search request?
         handle_find_address(street, &mySink);
     else if (map_string != NULL) 
         handle_draw_map(map_string, &mySink);   
+    else if (tile_string != NULL)
+        handle_draw_tile(tile_string, &mySink);
+    else if (route_string != NULL)
+        handle_draw_route(route_string, &mySink);
+    else if (seed_string != NULL)
+    {
+        if (sscanf(seed_string, "%d-%d", &min_zoom, &max_zoom) != 2)
+        {
+            min_zoom = 0;
+            max_zoom = atoi(seed_string);
+        }
+
+        if (seed_tiles(min_zoom, max_zoom, cache_dir) != 0)
+            result = EXIT_FAILURE;
+    }
+    else if (bench_string != NULL)
+        result = benchmark_encoders(atoi(bench_string));
 
 
     //destination = find_address(8102, "", "Gulf",  "Dr", "");
     //destination = find_address(5024, "W", "Nassau",  "St", "");
     //destination = find_address(0, "", "Morris Bridge",  "", "");
 
-    /*d = get_distance(&segment[source].StartPoint, &segment[destination].StartPoint);
+    /*d = get_distance(&segment_start[source], &segment_start[destination]);
     printf("Distance = %f miles\n\n", d);
 
     if (d > 10.0)
     {
     printf("Distance is too great, split A*\n");
 
-    waypoint1 = find_closest_highway(&segment[source].StartPoint);
-    format_street_name(str, segment[waypoint1].StreetIndex);
+    waypoint1 = find_closest_highway(&segment_start[source]);
+    format_street_name(str, segment_street[waypoint1]);
     printf("Closest highway is %s\n", str);
     find_shortest_path(source,waypoint1,0);
 
-    waypoint2 = find_closest_highway(&segment[destination].StartPoint);
-    format_street_name(str, segment[waypoint2].StreetIndex);
+    waypoint2 = find_closest_highway(&segment_start[destination]);
+    format_street_name(str, segment_street[waypoint2]);
     printf("Closest highway is %s\n", str);
     find_shortest_path(destination,waypoint2,0);
 
@@ -146,24 +281,98 @@ int main(int argc, char **argv)
     /*fp = fopen("test.png", "wb");
     mySink.context = (void *) fp;
     mySink.sink = stdioSink;
-    draw_map(800, 600, &segment[destination].StartPoint,20, &mySink);
+    draw_map(800, 600, &segment_start[destination],20, &mySink);
     fclose(fp);*/
 
-    free(segment);
-    free(street);
-    free(shape);
-    free(polygon);
+    unload_dataset();
+
+    return result;
+}
+
+
+static void free_chains(struct _Chains *chains)
+{
+    free(chains->first);
+    free(chains->point);
+    free(chains);
+}
+
+
+static void free_polygons(struct _Polygon *polygons, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        free(polygons[i].point);
+    free(polygons);
+}
+
+
+/* 
+* frees the chains and polygons of every detail level read from the data 
+* files.  A level that was not simplified shares the arrays of the level 
+* below it, and its polygons may share their points with that level.
+*/
+static void free_detail_levels()
+{
+    int level, i;
+
+    for (level = NUM_DETAIL_LEVELS - 1; level >= 0; level--)
+    {
+        if (level == 0 || shape_level[level] != shape_level[level-1])
+            free_chains(shape_level[level]);
+
+        if (level == 0 || polygon_level[level] != polygon_level[level-1])
+        {
+            for (i = 0; i < numPolygons; i++)
+            {
+                if (level == 0 || 
+                    polygon_level[level][i].point != polygon_level[level-1][i].point)
+                    free(polygon_level[level][i].point);
+            }
+            free(polygon_level[level]);
+        }
+    }
 
-    return EXIT_SUCCESS;
+    memset(shape_level, 0, sizeof(shape_level));
+    memset(polygon_level, 0, sizeof(polygon_level));
+    shape = NULL;
+    polygon = NULL;
 }
 
 
 /**
-* This function loads the specified file into memory pointed to by segment
+* Releases the dataset being served, whether it was read from the data files 
+* or mapped from a pack.
 */
-void load_segments_file(char *filename)
+void unload_dataset()
+{
+    destroy_spatial_index();
+    if (pack_mapped())
+        unload_pack();
+    else
+    {
+        free(segment_class);
+        free(segment_street);
+        free(segment_shape);
+        free(segment_start);
+        free(segment_end);
+        free(segment_address);
+        free(street);
+        free_detail_levels();
+        free(region);
+    }
+}
+
+
+/**
+* This function reads the records of the specified segments file and returns 
+* them.  The number of records is stored in count.
+*/
+struct _RoadSegment *read_segments_file(char *filename, int *count)
 {
     int length;
+    struct _RoadSegment *record;
     FILE *fp;
 
     fp = fopen( filename, "r" );
@@ -178,19 +387,90 @@ void load_segments_file(char *filename)
 
     //get length of file and number of records
     length = ftell( fp );
-    numRecs = length/sizeof(struct _RoadSegment);
+    *count = length/sizeof(struct _RoadSegment);
+
+    // a file cut short ends in a partial record
+    if (length % sizeof(struct _RoadSegment) != 0)
+    {
+        fprintf(stderr, "%s is truncated or not a segments file\n", filename);
+        exit(EXIT_FAILURE);
+    }
 
     //go back to beginning of file
     fseek( fp, 0, SEEK_SET );
 
     // allocate memory to hold all the road segments
-    segment = (struct _RoadSegment *) malloc(numRecs * sizeof(struct _RoadSegment));
+    record = (struct _RoadSegment *) malloc(*count * sizeof(struct _RoadSegment));
 
     // read all records from file
-    fread(segment, numRecs*sizeof(struct _RoadSegment), 1, fp);
+    fread(record, *count * sizeof(struct _RoadSegment), 1, fp);
 
     // we are done with the file
     fclose( fp );
+
+    return record;
+}
+
+
+/**
+* This function loads the specified file into the segment_xxx arrays
+*/
+void load_segments_file(char *filename)
+{
+    struct _RoadSegment *record;
+
+    record = read_segments_file(filename, &numRecs);
+    group_segments(record);
+    free(record);
+}
+
+
+/**
+* Stores the segments read from segments.dat in the segment_xxx arrays, 
+* ordered so that those drawn in the same pass are next to each other (see 
+* GROUP_xxx in tmrs.h), and fills in group_start.  The sort is stable so 
+* segments keep their relative order within a group.
+*/
+void group_segments(struct _RoadSegment *record)
+{
+    struct _AddressRange *address;
+    int i, j, group, next[NUM_GROUPS];
+
+    memset(group_start, 0, sizeof(group_start));
+
+    // count the number of segments in each group
+    for (i = 0; i < numRecs; i++)
+        ++group_start[get_road_group(record[i].RoadClass) + 1];
+
+    for (group = 0; group < NUM_GROUPS; group++)
+    {
+        group_start[group+1] += group_start[group];
+        next[group] = group_start[group];
+    }
+
+    segment_class = (char *) malloc(numRecs * sizeof(char));
+    segment_street = (int *) malloc(numRecs * sizeof(int));
+    segment_shape = (int *) malloc(numRecs * sizeof(int));
+    segment_start = (struct _Coordinates *) malloc(numRecs * sizeof(struct _Coordinates));
+    segment_end = (struct _Coordinates *) malloc(numRecs * sizeof(struct _Coordinates));
+    segment_address = (struct _AddressRange *) malloc(numRecs * sizeof(struct _AddressRange));
+
+    for (i = 0; i < numRecs; i++)
+    {
+        j = next[get_road_group(record[i].RoadClass)]++;
+
+        segment_class[j] = record[i].RoadClass;
+        segment_street[j] = record[i].StreetIndex;
+        segment_shape[j] = record[i].ShapeIndex;
+        segment_start[j] = record[i].StartPoint;
+        segment_end[j] = record[i].EndPoint;
+
+        address = &segment_address[j];
+        address->StartLeft = record[i].StartAddressLeft;
+        address->EndLeft = record[i].EndAddressLeft;
+        address->StartRight = record[i].StartAddressRight;
+        address->EndRight = record[i].EndAddressRight;
+    }
 }
 
 
@@ -216,6 +496,12 @@ void load_names_file(char *filename)
     length = ftell( fp );
     numStreets = length/sizeof(struct _StreetName);
 
+    if (length % sizeof(struct _StreetName) != 0)
+    {
+        fprintf(stderr, "%s is truncated or not a names file\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
     //go back to beginning of file
     fseek( fp, 0, SEEK_SET );
 
@@ -230,13 +516,64 @@ void load_names_file(char *filename)
 }
 
 
+/* 
+* Unpacks a chains file with delta coded points (see coords.h) that was read 
+* into data, which is freed.
+*/
+static struct _Chains *decode_chains(char *filename, unsigned char *data, int size)
+{
+    struct _Chains *chains;
+    unsigned char *p, *end;
+    int i, num_points, total;
+
+    chains = (struct _Chains *)malloc(sizeof(struct _Chains));
+    chains->count = (size >= 2*sizeof(int) && ((int *)data)[1] > 0) ? 
+        ((int *)data)[1] : 0;
+    chains->first = (int *)malloc((chains->count + 1) * sizeof(int));
+
+    // each point takes two bytes or more
+    chains->point = (struct _Coordinates *)malloc((size/2 + 1) * 
+        sizeof(struct _Coordinates));
+
+    p = data + 2*sizeof(int);
+    end = data + size;
+    total = 0;
+    for (i = 0; i < chains->count; i++)
+    {
+        chains->first[i] = total;
+
+        p = read_coded_int(p, end, &num_points);
+        if (p == NULL || num_points < 0 || num_points > (end - p) / 2 ||
+            (p = read_coded_points(p, end, &chains->point[total], num_points)) == NULL)
+        {
+            fprintf(stderr, "%s is truncated\n", filename);
+            break;
+        }
+
+        total += num_points;
+    }
+
+    for (; i <= chains->count; i++)
+        chains->first[i] = total;
+    chains->point = (struct _Coordinates *)realloc(chains->point, 
+        (total + 1) * sizeof(struct _Coordinates));
+    free(data);
+
+    return chains;
+}
+
+
 /**
-* This function loads the specified file into memory pointed to by shape
+* This function loads the specified chains file into memory and returns it.
+* The number of chains is stored in count.  The file is read in one go and 
+* the points of all chains are packed into a single array.
 */
-void load_shapes_file(char *filename)
+struct _Chains *load_shapes_file(char *filename, int *count)
 {   
     FILE *fp;
-    int i;
+    int i, j, size, length, num_points, total;
+    int *data;
+    struct _Chains *chains;
 
     fp = fopen(filename, "r");
     if (fp == NULL)
@@ -245,46 +582,156 @@ void load_shapes_file(char *filename)
         exit(EXIT_FAILURE);
     }
 
-    fread(&numShapes, sizeof(int), 1, fp);
-    shape = (struct _ShapePoints *) malloc(numShapes * sizeof(struct _ShapePoints));
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    data = (int *)malloc(size + sizeof(int));
+    size = fread(data, 1, size, fp);
+    fclose(fp);
+
+    if (size >= sizeof(int) && data[0] == CODED_MARKER)
+    {
+        chains = decode_chains(filename, (unsigned char *)data, size);
+        *count = chains->count;
+        return chains;
+    }
+
+    // the count, then the number of points and the points of each chain
+    length = size / sizeof(int);
+    chains = (struct _Chains *)malloc(sizeof(struct _Chains));
+    chains->count = (length > 0 && data[0] > 0) ? data[0] : 0;
+    chains->first = (int *)malloc((chains->count + 1) * sizeof(int));
 
-    //printf("Number of chains = %d\n", numShapes);
+    //printf("Number of chains = %d\n", chains->count);
 
-    for (i = 0; i < numShapes; i++)
+    // move the points of each chain down over the counts before them
+    total = 0;
+    j = 1;
+    for (i = 0; i < chains->count; i++)
     {
-        fread(&shape[i].num_points, sizeof(int), 1, fp);
-        shape[i].point = (struct _Coordinates *)malloc(shape[i].num_points * sizeof(struct _Coordinates));
-        fread(shape[i].point, sizeof(struct _Coordinates), shape[i].num_points, fp);
+        chains->first[i] = total;
 
-        //printf("%d: Number points = %d\n", i, shape[i].num_points);
+        num_points = (j < length) ? data[j++] : 0;
+        if (num_points < 0 || num_points > (length - j) / 2)
+        {
+            fprintf(stderr, "%s is truncated\n", filename);
+            num_points = 0;
+            j = length;
+        }
+
+        memmove(&data[2*total], &data[j], num_points * sizeof(struct _Coordinates));
+        j += 2*num_points;
+        total += num_points;
     }
+    chains->first[chains->count] = total;
+    chains->point = (struct _Coordinates *)realloc(data, 
+        (total + 1) * sizeof(struct _Coordinates));
 
-    fclose(fp);
+    *count = chains->count;
+
+    return chains;
+}
+
+
+/* 
+* Reads the rest of a polygons file with delta coded points (see coords.h),
+* starting at its count.
+*/
+static struct _Polygon *decode_polygons(char *filename, FILE *fp, int *count)
+{
+    unsigned char *data, *p, *end;
+    long start, size;
+    struct _Polygon *polygon;
+    int i, num_points;
+
+    start = ftell(fp);
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp) - start;
+    fseek(fp, start, SEEK_SET);
+
+    data = (unsigned char *)malloc(size + 1);
+    size = fread(data, 1, size, fp);
+    p = data;
+    end = data + size;
+
+    *count = 0;
+    if (size >= sizeof(int))
+    {
+        memcpy(count, p, sizeof(int));
+        p += sizeof(int);
+    }
+    if (*count < 0)
+        *count = 0;
+
+    polygon = (struct _Polygon *) malloc((*count + 1) * sizeof(struct _Polygon));
+    for (i = 0; i < *count; i++)
+    {
+        if (end - p < 1 + sizeof(polygon[i].name))
+            break;
+
+        polygon[i].type = *p++;
+        memcpy(polygon[i].name, p, sizeof(polygon[i].name));
+        p += sizeof(polygon[i].name);
+
+        p = read_coded_int(p, end, &num_points);
+        if (p == NULL || num_points < 0 || num_points > (end - p) / 2)
+            break;
+
+        polygon[i].num_points = num_points;
+        polygon[i].point = (struct _Coordinates *)malloc(num_points * sizeof(struct _Coordinates));
+        p = read_coded_points(p, end, polygon[i].point, num_points);
+        if (p == NULL)
+        {
+            free(polygon[i].point);
+            break;
+        }
+    }
+
+    if (i < *count)
+    {
+        fprintf(stderr, "%s is truncated\n", filename);
+        *count = i;
+    }
+
+    free(data);
+
+    return polygon;
 }
 
 
 /**
-* This function loads the specified file into memory pointed to by polygon
+* This function loads the specified polygons file into memory and returns it.
+* The number of polygons is stored in count.
 */
-void load_polygons_file(char *filename)
+struct _Polygon *load_polygons_file(char *filename, int *count)
 {
     FILE *fp;
     int i;
+    struct _Polygon *polygon;
 
+    *count = 0;
     fp = fopen(filename, "r");
     if (fp == NULL)
     {
         // Polygons data file is not absolutely necessary
         //perror(filename);
-        return;
+        return NULL;
     }
 
-    fread(&numPolygons, sizeof(int), 1, fp);
-    polygon = (struct _Polygon *) malloc(numPolygons * sizeof(struct _Polygon));
+    fread(count, sizeof(int), 1, fp);
+    if (*count == CODED_MARKER)
+    {
+        polygon = decode_polygons(filename, fp, count);
+        fclose(fp);
+        return polygon;
+    }
+
+    polygon = (struct _Polygon *) malloc(*count * sizeof(struct _Polygon));
 
-    //printf("Num polygons = %d\n", numPolygons);
+    //printf("Num polygons = %d\n", *count);
 
-    for (i = 0; i < numPolygons; i++)
+    for (i = 0; i < *count; i++)
     {
         fread(&polygon[i].type, sizeof(char), 1, fp);
         fread(polygon[i].name, sizeof(polygon[i].name), 1, fp);
@@ -295,6 +742,358 @@ void load_polygons_file(char *filename)
     }
 
     fclose(fp);
+
+    return polygon;
+}
+
+
+/**
+* Loads the bounding boxes of the polygons written by the converter.  Returns 
+* NULL if the file is missing, older than the polygons file or does not match 
+* the polygons loaded from it, in which case build_spatial_index() computes 
+* them.  Reading every point is what the file saves, so each box is only 
+* checked against the first and last point of its polygon.
+*/
+struct _BoundingBox *load_boxes_file(char *filename, char *polygons_filename)
+{
+    FILE *fp;
+    int i, n, last;
+    struct _BoundingBox *box;
+    struct stat boxes_st, polygons_st;
+
+    if (stat(filename, &boxes_st) != 0 || 
+        (stat(polygons_filename, &polygons_st) == 0 && 
+         polygons_st.st_mtime > boxes_st.st_mtime))
+        return NULL;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL)
+        return NULL;
+
+    box = NULL;
+    if (fread(&n, sizeof(int), 1, fp) == 1 && n == numPolygons && n > 0)
+    {
+        box = (struct _BoundingBox *)malloc(n * sizeof(struct _BoundingBox));
+        if (fread(box, sizeof(struct _BoundingBox), n, fp) != n)
+        {
+            free(box);
+            box = NULL;
+        }
+    }
+
+    fclose(fp);
+
+    for (i = 0; box != NULL && i < numPolygons; i++)
+    {
+        last = polygon[i].num_points - 1;
+        if (last >= 0 && (!box_contains(&box[i], &polygon[i].point[0]) || 
+                          !box_contains(&box[i], &polygon[i].point[last])))
+        {
+            fprintf(stderr, "%s does not match %s, ignored\n", filename, 
+                polygons_filename);
+            free(box);
+            box = NULL;
+        }
+    }
+
+    return box;
+}
+
+
+/**
+* Loads the simplified chains and polygons (chains<n>.dat, polygons<n>.dat) 
+* used for drawing at large scales.  A level that is missing or does not 
+* match the full detail data is replaced by the level below it.
+*/
+void load_detail_levels(char *data_dir)
+{
+    char filename[600];
+    struct _Chains *chains;
+    struct _Polygon *polygons;
+    int level, l, count, chains_valid = 1, polygons_valid = 1;
+
+    shape_level[0] = shape;
+    polygon_level[0] = polygon;
+
+    for (level = 1; level < NUM_DETAIL_LEVELS; level++)
+    {
+        shape_level[level] = shape_level[level-1];
+        polygon_level[level] = polygon_level[level-1];
+
+        // a level that does not match the data was simplified from other 
+        // data, so the levels before it are dropped as well and level 0 is 
+        // drawn at every scale
+        snprintf(filename, sizeof(filename), "%s/chains%d.dat", data_dir, level);
+        if (chains_valid && access(filename, R_OK) == 0)
+        {
+            chains = load_shapes_file(filename, &count);
+            if (count == numShapes)
+                shape_level[level] = chains;
+            else
+            {
+                fprintf(stderr, "%s does not match chains.dat, simplified "
+                    "chains ignored\n", filename);
+                free_chains(chains);
+                for (l = level - 1; l > 0; l--)
+                {
+                    if (shape_level[l] != shape_level[l-1])
+                        free_chains(shape_level[l]);
+                }
+                for (l = 1; l <= level; l++)
+                    shape_level[l] = shape;
+                chains_valid = 0;
+            }
+        }
+
+        snprintf(filename, sizeof(filename), "%s/polygons%d.dat", data_dir, level);
+        polygons = polygons_valid ? load_polygons_file(filename, &count) : NULL;
+        if (polygons != NULL && count == numPolygons)
+            polygon_level[level] = polygons;
+        else if (polygons != NULL)
+        {
+            fprintf(stderr, "%s does not match polygons.dat, simplified "
+                "polygons ignored\n", filename);
+            free_polygons(polygons, count);
+            for (l = level - 1; l > 0; l--)
+            {
+                if (polygon_level[l] != polygon_level[l-1])
+                    free_polygons(polygon_level[l], numPolygons);
+            }
+            for (l = 1; l <= level; l++)
+                polygon_level[l] = polygon;
+            polygons_valid = 0;
+        }
+    }
+}
+
+
+/* adds the chains in from after those in to */
+static void append_chains(struct _Chains *to, struct _Chains *from)
+{
+    int i, base, num_points;
+
+    base = to->first[to->count];
+    num_points = from->first[from->count];
+
+    to->first = (int *)realloc(to->first, (to->count + from->count + 1) * sizeof(int));
+    for (i = 0; i <= from->count; i++)
+        to->first[to->count + i] = base + from->first[i];
+
+    to->point = (struct _Coordinates *)realloc(to->point, 
+        (base + num_points + 1) * sizeof(struct _Coordinates));
+    memcpy(&to->point[base], from->point, num_points * sizeof(struct _Coordinates));
+
+    to->count += from->count;
+}
+
+
+/* 
+* adds n polygons after the count polygons in to, which is reallocated.  The 
+* points are not copied, the polygons keep using those of from.
+*/
+static struct _Polygon *append_polygons(struct _Polygon *to, int count, 
+                                        struct _Polygon *from, int n)
+{
+    to = (struct _Polygon *)realloc(to, (count + n + 1) * sizeof(struct _Polygon));
+    if (n > 0)
+        memcpy(&to[count], from, n * sizeof(struct _Polygon));
+
+    return to;
+}
+
+
+/**
+* Loads a dataset put together from several regions, e.g. counties that were 
+* converted separately.  The regions file lists the directories holding the 
+* data files of each region, relative to data_dir, one per line.  
+*
+* The regions are joined into a single dataset, so that maps and routes cross 
+* their borders as if the data had been converted in one go.  Segments, names,
+* chains and polygons of each region are stored after those of the regions 
+* before it (segments within each drawing group), and region[] records where 
+* they went.
+*/
+void load_regions(char *data_dir, char *filename)
+{
+    char line[256], dir[512], path[600];
+    struct _RoadSegment *record, *part;
+    struct _StreetName *names;
+    struct _Chains *chains[NUM_DETAIL_LEVELS];
+    struct _Polygon *polygons[NUM_DETAIL_LEVELS];
+    int shared_chains[NUM_DETAIL_LEVELS], shared_polygons[NUM_DETAIL_LEVELS];
+    int i, n, r, count, num_records, num_names, num_polygons, level, group, first;
+    struct _Region *rg;
+    FILE *fp;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL)
+    {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+
+    region = NULL;
+    numRegions = 0;
+    record = NULL;
+    num_records = 0;
+    names = NULL;
+    num_names = 0;
+    num_polygons = 0;
+
+    for (level = 0; level < NUM_DETAIL_LEVELS; level++)
+    {
+        chains[level] = (struct _Chains *)malloc(sizeof(struct _Chains));
+        chains[level]->count = 0;
+        chains[level]->first = (int *)calloc(1, sizeof(int));
+        chains[level]->point = NULL;
+        polygons[level] = NULL;
+
+        // a level missing from every region is shared as load_detail_levels() does
+        shared_chains[level] = shared_polygons[level] = (level > 0);
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        // a line that does not fit is rejected rather than read as two
+        if (strchr(line, '\n') == NULL && !feof(fp))
+        {
+            fprintf(stderr, "%s: line too long: %s...\n", filename, line);
+            exit(EXIT_FAILURE);
+        }
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        // dir leaves room in path for the name of any data file
+        n = snprintf(dir, sizeof(dir), "%s/%s", data_dir, line);
+        if (n < 0 || n >= sizeof(dir))
+        {
+            fprintf(stderr, "%s: the directory name of region %s is too long\n", 
+                filename, line);
+            exit(EXIT_FAILURE);
+        }
+
+        region = (struct _Region *)realloc(region, (numRegions + 1) * sizeof(struct _Region));
+        rg = &region[numRegions++];
+        memset(rg, 0, sizeof(struct _Region));
+        n = snprintf(rg->name, sizeof(rg->name), "%s", line);
+        if (n < 0 || n >= sizeof(rg->name))
+        {
+            fprintf(stderr, "%s: region name %s is too long\n", filename, line);
+            exit(EXIT_FAILURE);
+        }
+
+        // load the region as a dataset of its own
+        snprintf(path, sizeof(path), "%s/%s", dir, "segments.dat");
+        part = read_segments_file(path, &count);
+        snprintf(path, sizeof(path), "%s/%s", dir, "names.dat");
+        load_names_file(path);
+        snprintf(path, sizeof(path), "%s/%s", dir, "chains.dat");
+        shape = load_shapes_file(path, &numShapes);
+        snprintf(path, sizeof(path), "%s/%s", dir, "polygons.dat");
+        polygon = load_polygons_file(path, &numPolygons);
+        load_detail_levels(dir);
+
+        rg->first_street = num_names;
+        rg->num_streets = numStreets;
+        rg->first_shape = chains[0]->count;
+        rg->num_shapes = numShapes;
+        rg->first_polygon = num_polygons;
+        rg->num_polygons = numPolygons;
+
+        // then add it to the regions before it
+        for (i = 0; i < count; i++)
+        {
+            if (part[i].StreetIndex >= 0)
+                part[i].StreetIndex += rg->first_street;
+            if (part[i].ShapeIndex >= 0)
+                part[i].ShapeIndex += rg->first_shape;
+            ++rg->num_segments[get_road_group(part[i].RoadClass)];
+        }
+
+        record = (struct _RoadSegment *)realloc(record, 
+            (num_records + count) * sizeof(struct _RoadSegment));
+        memcpy(&record[num_records], part, count * sizeof(struct _RoadSegment));
+        num_records += count;
+        free(part);
+
+        names = (struct _StreetName *)realloc(names, 
+            (num_names + numStreets) * sizeof(struct _StreetName));
+        memcpy(&names[num_names], street, numStreets * sizeof(struct _StreetName));
+        num_names += numStreets;
+        free(street);
+
+        for (level = 0; level < NUM_DETAIL_LEVELS; level++)
+        {
+            append_chains(chains[level], shape_level[level]);
+            polygons[level] = append_polygons(polygons[level], num_polygons, 
+                polygon_level[level], numPolygons);
+
+            if (level > 0 && shape_level[level] != shape_level[level-1])
+                shared_chains[level] = 0;
+            if (level > 0 && polygon_level[level] != polygon_level[level-1])
+                shared_polygons[level] = 0;
+        }
+        num_polygons += numPolygons;
+
+        for (level = NUM_DETAIL_LEVELS - 1; level >= 0; level--)
+        {
+            if (level == 0 || shape_level[level] != shape_level[level-1])
+            {
+                free(shape_level[level]->first);
+                free(shape_level[level]->point);
+                free(shape_level[level]);
+            }
+            if (level == 0 || polygon_level[level] != polygon_level[level-1])
+                free(polygon_level[level]);
+        }
+    }
+
+    fclose(fp);
+
+    numRecs = num_records;
+    group_segments(record);
+    free(record);
+
+    // within each group, the segments of a region follow those of the 
+    // regions before it
+    for (group = 0; group < NUM_GROUPS; group++)
+    {
+        first = group_start[group];
+        for (r = 0; r < numRegions; r++)
+        {
+            region[r].first_segment[group] = first;
+            first += region[r].num_segments[group];
+        }
+    }
+
+    street = names;
+    numStreets = num_names;
+
+    for (level = 0; level < NUM_DETAIL_LEVELS; level++)
+    {
+        if (shared_chains[level])
+        {
+            free(chains[level]->first);
+            free(chains[level]->point);
+            free(chains[level]);
+            chains[level] = chains[level-1];
+        }
+        if (shared_polygons[level])
+        {
+            free(polygons[level]);
+            polygons[level] = polygons[level-1];
+        }
+
+        shape_level[level] = chains[level];
+        polygon_level[level] = polygons[level];
+    }
+
+    shape = shape_level[0];
+    numShapes = shape->count;
+    polygon = polygon_level[0];
+    numPolygons = num_polygons;
 }
 
 
@@ -360,8 +1159,8 @@ void handle_find_address(char *address, gdSink *pSink)
             if (street_number == 0)
             {
                 format_street_name(str, i);
-                sprintf(str2, "A:%d:x %s:%d,%d\n", j, str, segment[j].StartPoint.Latitude, 
-                    segment[j].StartPoint.Longitude);
+                sprintf(str2, "A:%d:x %s:%d,%d\n", j, str, segment_start[j].Latitude, 
+                    segment_start[j].Longitude);
                 pSink->sink(pSink->context, str2, strlen(str2));
                 ++match_count;
                 continue;
@@ -370,14 +1169,14 @@ void handle_find_address(char *address, gdSink *pSink)
             // now look for the street number in the segments array
             for (j = 0; j < numRecs; j++)
             {
-                if (segment[j].StreetIndex == i)
+                if (segment_street[j] == i)
                 {
-                    if (CONTAINS(segment[j].StartAddressLeft, segment[j].EndAddressLeft, street_number) ||
-                        CONTAINS(segment[j].StartAddressRight, segment[j].EndAddressRight, street_number))
+                    if (CONTAINS(segment_address[j].StartLeft, segment_address[j].EndLeft, street_number) ||
+                        CONTAINS(segment_address[j].StartRight, segment_address[j].EndRight, street_number))
                     {
                         format_street_name(str, i);
                         sprintf(str2, "A:%d:%d %s:%d,%d\n", j, street_number, str, 
-                            segment[j].StartPoint.Latitude, segment[j].StartPoint.Longitude);
+                            segment_start[j].Latitude, segment_start[j].Longitude);
                         pSink->sink(pSink->context, str2, strlen(str2));
                         ++match_count;
                     }
@@ -435,6 +1234,79 @@ void handle_draw_map(char *str, gdSink *pSink)
 }
 
 
+/**
+* Draws a single map tile and sends it to the provided sink.  Tiles follow 
+* the usual zoom/x/y numbering of spherical mercator maps.  The format of the
+* request string is as follows:
+*
+*      "<format>,<zoom>,<x>,<y>"
+*
+*      eg - "PNG,14,4437,6950"
+*/
+void handle_draw_tile(char *str, gdSink *pSink)
+{
+    char *format, *zoom, *x, *y, msg[64];
+    const char delimiters[] = ",";
+
+    format = strtok(str, delimiters);
+    zoom = strtok(NULL, delimiters);
+    x = strtok(NULL, delimiters);
+    y = strtok(NULL, delimiters);
+
+    if (!format || !zoom || !x || !y || 
+        draw_tile(format, atoi(zoom), atoi(x), atoi(y), pSink) < 0)
+    {
+        sprintf(msg, "E:Invalid tile request.\n");
+        pSink->sink(pSink->context, msg, strlen(msg));
+    }
+}
+
+
+/**
+* Finds the shortest path between two road segments and draws a map fitted 
+* to it, with the route highlighted.  The segments are numbered as in the 
+* output of an address search.  The format of the request string is as 
+* follows:
+*
+*      "<format>,<img_width>,<img_height>,<source>,<destination>"
+*
+*      eg - "PNG,640,480,3378,17766"
+*/
+void handle_draw_route(char *str, gdSink *pSink)
+{
+    char *format, *width, *height, *source, *destination, msg[64];
+    int *route, count;
+    const char delimiters[] = ",";
+
+    format = strtok(str, delimiters);
+    width = strtok(NULL, delimiters);
+    height = strtok(NULL, delimiters);
+    source = strtok(NULL, delimiters);
+    destination = strtok(NULL, delimiters);
+
+    if (!format || !width || !height || !source || !destination || 
+        atoi(width) < 1 || atoi(height) < 1 || 
+        atoi(source) < 0 || atoi(source) >= numRecs || 
+        atoi(destination) < 0 || atoi(destination) >= numRecs)
+    {
+        sprintf(msg, "E:Invalid route request.\n");
+        pSink->sink(pSink->context, msg, strlen(msg));
+        return;
+    }
+
+    count = find_shortest_path(atoi(source), atoi(destination), 0, &route);
+    if (count == 0)
+    {
+        sprintf(msg, "E:No route found.\n");
+        pSink->sink(pSink->context, msg, strlen(msg));
+        return;
+    }
+
+    draw_route_map(format, atoi(width), atoi(height), route, count, pSink);
+    free(route);
+}
+
+
 /**
 * Returns the closest highway to the given point.  The index of the highway 
 * segment is what is returned if found.  Otherwise -1 is returned.
@@ -448,18 +1320,16 @@ int find_closest_highway(struct _Coordinates *m)
     min_distance = 99999.0;
     segment_index = -1;
 
-    for (i = 0; i < numRecs; i++)
+    for (i = group_start[GROUP_HIGHWAY]; i < group_start[GROUP_HIGHWAY+1]; i++)
     {
-        if (segment[i].RoadClass > 19)  continue;
-
-        d = get_manhattan_distance(&segment[i].StartPoint, m);
+        d = get_manhattan_distance(&segment_start[i], m);
         if (d < min_distance)
         {
             min_distance = d;
             segment_index = i;
         }
 
-        d = get_manhattan_distance(&segment[i].EndPoint, m);
+        d = get_manhattan_distance(&segment_end[i], m);
         if (d < min_distance)
         {
             min_distance = d;
@@ -27,6 +27,7 @@
 
 #define CONTAINS(a,b,x)  ( ( x>=a && x<=b ) || ( x>=b && x<=a ) )
 
+#include <sys/uio.h>
 #include "gd.h"
 #include "tmrs_structs.h"
 
@@ -49,15 +50,237 @@ struct _ListNode
     struct _ListNode *next;
 };
 
+// the shape points of all chains of one detail level, stored one chain after 
+// the other.  Chain i is point[first[i]] to point[first[i+1]-1].
+struct _Chains
+{
+    int count;
+    int *first;                  // count+1 entries
+    struct _Coordinates *point;
+};
+
+#define CHAIN_LENGTH(c,i)   ((c)->first[(i)+1] - (c)->first[i])
+#define CHAIN_POINTS(c,i)   (&(c)->point[(c)->first[i]])
+
+// the address ranges of a road segment (see segment_address)
+struct _AddressRange
+{
+    int StartLeft, EndLeft;
+    int StartRight, EndRight;
+};
+
+// uniform grid over the dataset used to find what lies within a map window.  
+// The items of cell n are item[cell_start[n]] to item[cell_start[n+1]-1].
+struct _Grid
+{
+    struct _BoundingBox bounds;
+    int cols, rows;
+    int cell_width, cell_height;
+    int *cell_start;
+    int *item;
+};
+
+
+// map projections understood by project_point()
+#define PROJECTION_LINEAR       0   // longitude/latitude scaled around a center
+#define PROJECTION_MERCATOR     1   // spherical mercator as used by map tiles
+
+#define TILE_SIZE       256     // width and height of a map tile in pixels
+#define METATILE_SIZE   8       // tiles are rendered in blocks of 8 x 8 tiles
+#define MAX_ZOOM        20
+
+// part of the key of cached tiles.  Bump whenever the way maps are drawn 
+// changes so that old tiles are not served.
+#define MAP_STYLE_VERSION   6
+
+// how roads and polygons are drawn, selected with the -b option
+#define BACKEND_GD              0   // libgd (default)
+#define BACKEND_SCANLINE        1   // scanline rasterizer in raster.c
+#define BACKEND_SCANLINE_AA     2   // same, anti-aliased
+#define NUM_BACKENDS            3
+
+// describes how coordinates are mapped onto the pixels of an image
+struct _MapView
+{
+    int projection;
+    int width, height;
+    int scale;                   // coordinate units per pixel, picks the style
+    struct _Coordinates center;  // linear: point at the center of the image
+    int zoom;                    // mercator: zoom level
+    double origin_x, origin_y;   // mercator: world pixel of the top left corner
+    int detail;                  // which simplified chains and polygons to draw
+    struct _Raster *raster;      // set while drawing with the scanline backend
+    int band_top, band_height;   // rows being drawn, see render_map()
+    struct _LabelSet *labels;    // label candidates found while drawing
+    int *route;                  // segments drawn as a route on top, or NULL
+    int route_length;
+    gdPoint *clip_point[2];      // room for polygons while clipping them, 
+    int clip_allocated[2];       // reused by draw_polygon() within a band
+};
+
+// polygons reaching past the map are clipped this many pixels outside of it, 
+// so that the edges added along the cut are never seen.  The corners made by 
+// the cut are rounded to whole pixels, so the edges of a clipped polygon can 
+// land a pixel away from where they would unclipped, but every band of a map 
+// cuts a polygon in the same place.
+#define CLIP_MARGIN     2
+
+// route overlay (see draw_route_map()): line width in pixels and the space 
+// kept free around the route when fitting the map to it
+#define ROUTE_WIDTH     6
+#define ROUTE_MARGIN    24
+
+// how a road is drawn, see get_line_style()
+struct _LineStyle
+{
+    int casing_width, casing_color;
+    int fill_width, fill_color;
+    int label;                     // 1 if the road gets a street label
+};
+
+// a street label as placed on the map, see layout_labels()
+struct _PlacedLabel
+{
+    char *text;
+    double size;                 // in points
+    double angle;                // in radians, counter clockwise
+    int x, y;                    // start of the baseline
+    struct _TextImage *image;    // the text as drawn by gd
+};
+
+// maps are drawn in horizontal bands of at least this many rows, each band 
+// by its own thread (-j option)
+#define MIN_BAND_HEIGHT     64
+#define MAX_BANDS           64
+#define BAND_OVERLAP        8   // rows drawn past each edge of a band, more than 
+                                    // half the widest line (see render_map())
+
+
+// growing block of memory that a gdSink can write into (see buffer_sink())
+struct _Buffer
+{
+    char *data;
+    int size;
+    int allocated;
+};
+
+
+// segments are kept grouped by the pass in which draw_map() draws them.  
+// Group n holds segments group_start[n] to group_start[n+1]-1.
+#define GROUP_MINOR     0   // local streets, trails and water boundaries
+#define GROUP_MAJOR     1   // primary roads (class 20-29)
+#define GROUP_HIGHWAY   2   // limited access highways (class below 20)
+#define NUM_GROUPS      3
+
+// A dataset can be put together from several regions, e.g. counties that 
+// were converted separately, by listing their directories in this file of 
+// the data directory (see load_regions()).
+#define REGIONS_FILENAME    "regions"
+
+// where the data of one region ended up in the dataset, as stored in a pack.
+// Its segments make up one run in each drawing group.
+struct _Region
+{
+    char name[32];
+    struct _BoundingBox bounds;
+    int first_segment[NUM_GROUPS], num_segments[NUM_GROUPS];
+    int first_street, num_streets;
+    int first_shape, num_shapes;
+    int first_polygon, num_polygons;
+};
+
+
+// a dataset packed into one file (tmrs.pack in the data directory) that is 
+// mapped into memory instead of being read, see pack.c
+#define PACK_FILENAME   "tmrs.pack"
+#define PACK_MAGIC      "TMRSPACK"
+#define PACK_VERSION    4
+#define PACK_BYTE_ORDER 0x01020304
+#define PACK_SWAPPED_BYTE_ORDER 0x04030201  // as read with the other byte order
+#define PACK_ALIGN      64      // every section starts at a multiple of this
+
+// sections of a pack.  The chains and polygons of each detail level are an 
+// index followed by the points of all of them.
+#define PACK_SEGMENT_CLASSES        0   // char, segments grouped
+#define PACK_SEGMENT_STREETS        1   // int
+#define PACK_SEGMENT_SHAPES         2   // int
+#define PACK_SEGMENT_STARTS         3   // struct _Coordinates
+#define PACK_SEGMENT_ENDS           4   // struct _Coordinates
+#define PACK_SEGMENT_ADDRESSES      5   // struct _AddressRange
+#define PACK_NAMES                  6   // struct _StreetName
+#define PACK_SEGMENT_BOXES          7   // struct _BoundingBox
+#define PACK_POLYGON_BOXES          8   // struct _BoundingBox
+#define PACK_REGIONS                9   // struct _Region
+#define PACK_CHAINS(level)          (10 + 4*(level)) // struct _Chains first[]
+#define PACK_CHAIN_POINTS(level)    (11 + 4*(level)) // struct _Coordinates
+#define PACK_POLYGONS(level)        (12 + 4*(level)) // struct _PackedPolygon
+#define PACK_POLYGON_POINTS(level)  (13 + 4*(level)) // struct _Coordinates
+#define NUM_PACK_SECTIONS           (10 + 4*NUM_DETAIL_LEVELS)
+
+// where a section of a pack starts, its length in bytes and its checksum
+struct _PackSection
+{
+    long long offset;
+    long long size;
+    unsigned int crc;       // crc32c() of its bytes
+    unsigned int unused;
+};
+
+// the start of a pack
+struct _PackHeader
+{
+    char magic[8];
+    int byte_order;         // PACK_BYTE_ORDER
+    int version;
+    unsigned int header_crc;    // crc32c() of the header with this set to 0
+    int num_segments, num_streets, num_shapes, num_polygons, num_regions;
+    int group_start[NUM_GROUPS+1];
+    struct _PackSection section[NUM_PACK_SECTIONS];
+};
+
+// a polygon as stored in a pack
+struct _PackedPolygon
+{
+    char type;
+    char name[30];
+    int first_point;
+    int num_points;
+};
+
 
 // global variables
-struct _RoadSegment *segment;
+
+// The road segments, one array per field of struct _RoadSegment so that the 
+// drawing and routing loops, which look at a few fields of many segments, 
+// don't pull the address ranges through the cache.  Indexed by segment 
+// number, in the order of group_segments().
+char *segment_class;                    // RoadClass
+int *segment_street;                    // StreetIndex
+int *segment_shape;                     // ShapeIndex
+struct _Coordinates *segment_start;     // StartPoint
+struct _Coordinates *segment_end;       // EndPoint
+struct _AddressRange *segment_address;
 struct _StreetName *street;
-struct _ShapePoints *shape;
+struct _Chains *shape;
 struct _Polygon *polygon;
+struct _Chains *shape_level[NUM_DETAIL_LEVELS];      // [0] is the same as shape
+struct _Polygon *polygon_level[NUM_DETAIL_LEVELS];    // [0] is the same as polygon
 int numRecs, numStreets, numShapes, numPolygons;;
 struct _ListNode *open_list_head;
 struct _ListNode *closed_list_head;
+struct _BoundingBox *segment_box, *polygon_box, dataset_bounds;
+struct _Grid segment_grid, polygon_grid;
+int group_start[NUM_GROUPS+1];
+struct _Region *region;     // NULL unless the dataset is made up of regions
+int numRegions;
+int render_backend;
+int render_threads;     // threads drawing a map, 0 for one per CPU
+
+// colors of the map style, see init_map_colors()
+int background, minor_street, major_street, highway, black, blue;
+int gray, green;
+int light_gray, dark_gray;
+int route_color;
 
 
 //// function prototypes
@@ -65,6 +288,10 @@ struct _ListNode *closed_list_head;
 // functions in tmrs.c
 void handle_find_address(char *, gdSink *sink);
 void handle_draw_map(char *str, gdSink *pSink);
+void handle_draw_tile(char *str, gdSink *pSink);
+void handle_draw_route(char *str, gdSink *pSink);
+void unload_dataset();
+void load_regions(char *data_dir, char *filename);
 
 // functions implemented in linked_list.c
 void open_list_add(struct _GraphNode *node);
@@ -76,7 +303,7 @@ void open_list_destroy();
 void closed_list_destroy();
 
 // functions implemented in a_star.c
-void find_shortest_path(int source, int destination, int highwayOnly);
+int find_shortest_path(int source, int destination, int highwayOnly, int **route);
 int process_adjacent_nodes(struct _GraphNode *, int, int);
 
 // functions implemented in utils.c
@@ -85,15 +312,138 @@ double get_manhattan_distance(struct _Coordinates *a, struct _Coordinates *b);
 int same_point(struct _Coordinates *a, struct _Coordinates *b);
 void print_segment(int i);
 void format_street_name(char *str, int street_index);
+int get_road_group(char road_class);
+double mercator_x(int longitude, int zoom);
+double mercator_y(int latitude, int zoom);
+int mercator_longitude(double x, int zoom);
+int mercator_latitude(double y, int zoom);
+int buffer_sink(void *context, const char *data, int len);
+int sink_write(gdSinkPtr pSink, char *data, int len);
+int fd_sink(void *context, const char *data, int len);
+int sink_writev(gdSinkPtr pSink, struct iovec *iov, int n);
 void print_open_list();
 void print_closed_list();
 
+// functions implemented in grid.c
+void extend_box(struct _BoundingBox *box, struct _Coordinates *p);
+int box_contains(struct _BoundingBox *box, struct _Coordinates *p);
+int boxes_intersect(struct _BoundingBox *a, struct _BoundingBox *b);
+void grid_build(struct _Grid *g, struct _BoundingBox *box, int count, 
+                struct _BoundingBox *bounds);
+int grid_query(struct _Grid *g, struct _BoundingBox *area, 
+               struct _BoundingBox *item_box, int **result);
+void grid_destroy(struct _Grid *g);
+void build_spatial_index();
+void destroy_spatial_index();
+
 // functions implemented in map.c
 int draw_map(char *format, int width, int height, struct _Coordinates *c, 
              int scale, gdSink *sink);
+int draw_route_map(char *format, int width, int height, int *route, int count, 
+                   gdSink *pSink);
+gdImagePtr render_map(struct _MapView *view);
+int get_detail_level(int scale);
+int get_line_style(char road_class, int scale, struct _LineStyle *style);
+int get_polygon_color(char type);
+void init_map_colors();
+int project_segment(int i, struct _MapView *view, gdPoint *points);
+int get_segment_points(int i, int detail);
+void add_chain_labels(struct _MapView *view, int i, gdPoint *points, 
+                      int num_points);
+int get_backend(char *name);
+char *get_backend_name(int backend);
+
+// functions implemented in label.c
+struct _LabelSet *label_set_create();
+void label_set_destroy(struct _LabelSet *set);
+void add_street_label(struct _LabelSet *set, int i, int first_segment, 
+                      int street_index, char road_class, 
+                      int x1, int y1, int x2, int y2);
+void merge_label_set(struct _LabelSet *set, struct _LabelSet *from, int dy);
+int layout_labels(struct _LabelSet *set, int width, int height, int color, 
+                  void (*print)(void *context, struct _PlacedLabel *placed), 
+                  void *context);
+int place_labels(struct _LabelSet *set, gdImagePtr im, int color);
+
+// functions implemented in text_cache.c
+struct _TextImage *get_text_image(char *font, char *text, double size, 
+                                  double angle, int color);
+int *get_text_brect(struct _TextImage *t);
+void draw_text_image(gdImagePtr im, struct _TextImage *t, int x, int y);
+
+// functions implemented in png.c
+int set_png_compression(char *str);
+int get_png_level();
+int get_png_strategy();
+void image_png8_to_sink(gdImagePtr im, gdSinkPtr pSink);
+void image_png24_to_sink(gdImagePtr im, gdSinkPtr pSink);
+
+// functions implemented in encode.c
+int get_encoder(char *format);
+char *get_encoder_name(int n);
+void image_to_sink(gdImagePtr im, char *format, gdSinkPtr pSink);
+
+// functions implemented in benchmark.c
+int benchmark_encoders(int zoom);
+
+// functions implemented in raster.c
+struct _Raster *raster_create(gdImagePtr im, int top, int antialias);
+void raster_destroy(struct _Raster *r);
+void raster_polygon(struct _Raster *r, gdPoint *p, int n, int color);
+void raster_polyline(struct _Raster *r, gdPoint *p, int n, int width, int color);
+void project_point(struct _MapView *view, struct _Coordinates *m, int *x, int *y);
+void get_map_bounds(struct _MapView *view, struct _BoundingBox *box);
+
+// functions implemented in svg.c
+int draw_map_svg(struct _MapView *view, gdSinkPtr pSink);
+
+// functions implemented in mvt.c
+int encode_vector_tile(int zoom, int x, int y, struct _Buffer *buffer);
+
+// functions implemented in tile.c
+int get_metatile_span(int zoom);
+void get_tile_view(struct _MapView *view, int zoom, int x, int y, int span);
+int draw_tile(char *format, int zoom, int x, int y, gdSink *pSink);
+gdImagePtr get_tile_image(int zoom, int x, int y);
+void drop_metatile();
+int seed_metatile(char *format, int zoom, int mx, int my, 
+                  int x1, int y1, int x2, int y2, int *tiles, long *bytes);
+
+// functions implemented in tile_cache.c
+void tile_cache_init(int memory_limit, char *dir);
+int tile_cache_enabled();
+int tile_cache_get(char *format, int zoom, int x, int y, gdSinkPtr pSink);
+int tile_cache_put(char *format, int zoom, int x, int y, char *data, int size);
+void tile_cache_clear();
+void get_tile_path(char *path, char *format, int zoom, int x, int y);
+void make_parent_dirs(char *path);
+
+// functions implemented in seed.c
+int seed_tiles(int min_zoom, int max_zoom, char *dir);
+void get_tile_range(int zoom, int *x1, int *y1, int *x2, int *y2);
+
+// functions implemented in crc.c
+unsigned int crc32c(unsigned int crc, const void *data, size_t size);
+
+// functions implemented in pack.c
+int load_pack(char *filename);
+void unload_pack();
+int in_pack(void *p);
+int pack_mapped();
+unsigned int pack_id();
+void set_pack_verification(int on);
+int write_pack(char *filename);
+int reload_pack(char *filename);
+
+// functions implemented in region.c
+void set_region_budget(long bytes);
+void init_regions();
+void measure_regions();
+void use_regions(struct _BoundingBox *area);
 
 // functions implemented in server.c
-void server_start();
+void server_start(char *pack_filename);
+void server_start_unix(char *pack_filename);
 
 
 #endif
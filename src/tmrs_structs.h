@@ -35,6 +35,12 @@
 #define POLYGON_PARK            0x03
 #define POLYGON_EDUCATION       0x04
 
+// Besides chains.dat and polygons.dat, the converters write simplified copies
+// named chains<n>.dat and polygons<n>.dat for each detail level n > 0.  No 
+// point of level n is further than DETAIL_TOLERANCE(n) from the original.
+#define NUM_DETAIL_LEVELS       4
+#define DETAIL_TOLERANCE(n)     (10 << (2*(n)))     // 40, 160, 640
+
 
 // struct to hold longitude and latitude of a point
 struct _Coordinates 
@@ -43,6 +49,13 @@ struct _Coordinates
     int Latitude;
 };
 
+// rectangle enclosing a set of points
+struct _BoundingBox
+{
+    struct _Coordinates Min;    // south-west corner
+    struct _Coordinates Max;    // north-east corner
+};
+
 // a road segment, as stored in the data file
 struct _RoadSegment
 {
@@ -58,13 +71,6 @@ struct _RoadSegment
     char RoadClass;  // the two numbers after 'A'
 };
 
-// list of shape points for a given road segment
-struct _ShapePoints
-{
-    int num_points;
-    struct _Coordinates *point;
-};
-
 // street name info as stored in data file
 struct _StreetName
 {
@@ -83,3 +89,6 @@ struct _Polygon
     struct _Coordinates *point; 
 };
 
+// polygon_boxes.dat holds the count followed by the _BoundingBox of each 
+// polygon in polygons.dat, in the same order
+
@@ -22,10 +22,18 @@
 *****************************************************************************/
 
 
+#include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
 #include "tmrs.h"
 
+#ifndef IOV_MAX
+#define IOV_MAX     1024
+#endif
+
 
 /* Gets the approximate distance between two points in miles */
 double get_distance(struct _Coordinates *a, struct _Coordinates *b)
@@ -70,17 +78,17 @@ void print_segment(int i)
     int st_index;
     char str[64];
 
-    st_index = segment[i].StreetIndex;
+    st_index = segment_street[i];
 
     format_street_name(str, st_index);   
     /*printf("(A:%d,%d B:%d,%d) \n", 
-    segment[i].StartPoint.Longitude, segment[i].StartPoint.Latitude,
-    segment[i].EndPoint.Longitude, segment[i].EndPoint.Latitude);
+    segment_start[i].Longitude, segment_start[i].Latitude,
+    segment_end[i].Longitude, segment_end[i].Latitude);
     */
     printf("%s  \t(L:%.4d-%.4d  R:%.4d-%.4d) \t-A%d-", str, 
-        segment[i].StartAddressLeft, segment[i].EndAddressLeft,
-        segment[i].StartAddressRight, segment[i].EndAddressRight,
-        segment[i].RoadClass);  
+        segment_address[i].StartLeft, segment_address[i].EndLeft,
+        segment_address[i].StartRight, segment_address[i].EndRight,
+        segment_class[i]);  
 }
 
 
@@ -136,6 +144,137 @@ void format_street_name(char *str, int street_index)
 }
 
 
+/* returns the drawing group (GROUP_xxx) a road class belongs to */
+int get_road_group(char road_class)
+{
+    if (road_class < 20)
+        return GROUP_HIGHWAY;
+    else if (road_class < 30)
+        return GROUP_MAJOR;
+
+    return GROUP_MINOR;
+}
+
+
+/* 
+* Spherical mercator conversions used for map tiles.  At a given zoom the 
+* world is a square of (TILE_SIZE << zoom) pixels with (0,0) at the north 
+* west corner.  Coordinates are in millionths of a degree.
+*/
+double mercator_x(int longitude, int zoom)
+{
+    return (longitude / 1000000.0 + 180.0) / 360.0 * (double)(TILE_SIZE << zoom);
+}
+
+double mercator_y(int latitude, int zoom)
+{
+    double lat;
+
+    lat = latitude / 1000000.0 * M_PI / 180.0;
+    return (1.0 - log(tan(lat) + 1.0/cos(lat)) / M_PI) / 2.0 * (double)(TILE_SIZE << zoom);
+}
+
+int mercator_longitude(double x, int zoom)
+{
+    return (int)((x / (double)(TILE_SIZE << zoom) * 360.0 - 180.0) * 1000000.0);
+}
+
+int mercator_latitude(double y, int zoom)
+{
+    double n;
+
+    n = M_PI * (1.0 - 2.0 * y / (double)(TILE_SIZE << zoom));
+    return (int)(atan(sinh(n)) * 180.0 / M_PI * 1000000.0);
+}
+
+
+/* 
+* gdSink callback that appends the output to a struct _Buffer.  The buffer 
+* should start out zeroed; the caller frees buffer->data when done.
+*/
+int buffer_sink(void *context, const char *data, int len)
+{
+    struct _Buffer *buffer = (struct _Buffer *)context;
+
+    if (buffer->size + len > buffer->allocated)
+    {
+        buffer->allocated = 2 * (buffer->size + len);
+        buffer->data = (char *)realloc(buffer->data, buffer->allocated);
+    }
+
+    memcpy(&buffer->data[buffer->size], data, len);
+    buffer->size += len;
+
+    return len;
+}
+
+
+/* sends a whole block to a sink, returns -1 if the sink fails */
+int sink_write(gdSinkPtr pSink, char *data, int len)
+{
+    int res, nwritten = 0;
+
+    while (nwritten < len)
+    {
+        res = pSink->sink(pSink->context, &data[nwritten], len - nwritten);
+        if (res <= 0) return -1;
+        nwritten += res;
+    }
+
+    return 0;
+}
+
+
+/* gdSink callback that writes to the file descriptor (socket) in *context */
+int fd_sink(void *context, const char *data, int len)
+{
+    return write(*(int *)context, data, len);
+}
+
+
+/* 
+* sends a list of blocks to a sink, returns -1 if the sink fails.  A file 
+* descriptor sink gets them with as few writev() calls as possible instead 
+* of one call per block.  The iovecs are used up in the process.
+*/
+int sink_writev(gdSinkPtr pSink, struct iovec *iov, int n)
+{
+    int fd;
+    ssize_t res;
+
+    if (pSink->sink != fd_sink)
+    {
+        for (; n > 0; iov++, n--)
+            if (sink_write(pSink, (char *)iov->iov_base, iov->iov_len) < 0)
+                return -1;
+        return 0;
+    }
+
+    fd = *(int *)pSink->context;
+    while (n > 0)
+    {
+        res = writev(fd, iov, n < IOV_MAX ? n : IOV_MAX);
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return -1;
+
+        // skip what went out, which may end in the middle of a block
+        while (n > 0 && res >= iov->iov_len)
+        {
+            res -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + res;
+            iov->iov_len -= res;
+        }
+    }
+
+    return 0;
+}
+
+
 /* prints the 'open list' in a human readable form */
 void print_open_list()
 {